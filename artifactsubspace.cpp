@@ -0,0 +1,400 @@
+#include "artifactsubspace.h"
+#include <algorithm>
+#include <cmath>
+
+// the covariance forgets with this time constant, the length of the calibration windows
+static const double dCovarianceTime = 0.5;
+// seconds between rebuilds of the reconstruction matrix while components are rejected
+static const double dRebuildInterval = 0.1;
+// components whose correlation in the current basis is below this are left unrotated
+static const double dTrackingTolerance = 0.3;
+
+ArtifactSubspaceReconstruction::ArtifactSubspaceReconstruction(int nChannels,
+	double dSamplingRate, int nMaxBlockLen, double dCalibration, double dCutoff,
+	double dHighpass)
+	: m_nChannels(nChannels), m_nCapacity(nMaxBlockLen),
+	  m_nMaxRejected(std::max(1, 2 * nChannels / 3)), m_dRate(dSamplingRate), m_dCutoff(dCutoff),
+	  m_dHighpass(std::exp(-2 * 3.14159265358979 * dHighpass / dSamplingRate)),
+	  m_phase(Covariance), m_nPhaseSamples(0), m_nWindowPos(0), m_nWindows(0),
+	  m_nSinceRebuild(0), m_nRotationCursor(0)
+{
+	const std::size_t nBlock = static_cast<std::size_t>(nChannels) * nMaxBlockLen;
+	const std::size_t nMatrix = static_cast<std::size_t>(nChannels) * nChannels;
+	for (auto* pBlock : {&m_pdIn, &m_pdOut, &m_pdY, &m_pdBlend}) pBlock->resize(nBlock);
+	m_pdPrevIn.resize(nChannels);
+	m_pdPrevOut.resize(nChannels);
+	m_nWindowLen = std::max(1, static_cast<int>(std::lround(dCovarianceTime * dSamplingRate)));
+	m_nPhaseLen =
+		std::max<int64_t>(m_nWindowLen, std::llround(dCalibration / 2 * dSamplingRate));
+	m_pdWindowSum.resize(nChannels);
+	m_pdWindowRms.resize(static_cast<std::size_t>(m_nPhaseLen / m_nWindowLen + 1) * nChannels);
+	m_pdMedian.resize(m_nPhaseLen / m_nWindowLen + 1);
+	for (auto* pMatrix : {&m_pdReference, &m_pdA, &m_pdB, &m_pdV, &m_pdS, &m_current.pdVrT,
+			 &m_current.pdM, &m_previous.pdVrT, &m_previous.pdM})
+		pMatrix->resize(nMatrix);
+	m_current.nRejected = m_previous.nRejected = 0;
+	m_pnCandidates.reserve(nChannels);
+	m_keep.assign(nChannels, 1);
+	m_prevKeep.assign(nChannels, 1);
+}
+
+void ArtifactSubspaceReconstruction::Highpass(int nSamples)
+{
+	for (int c = 0; c < m_nChannels; c++)
+	{
+		double* pdX = &m_pdIn[c * m_nCapacity];
+		// start from the first sample rather than from 0, so the offset doesn't ring
+		if (m_phase == Covariance && m_nPhaseSamples == 0) m_pdPrevIn[c] = pdX[0];
+		double dPrevIn = m_pdPrevIn[c], dPrevOut = m_pdPrevOut[c];
+		for (int s = 0; s < nSamples; s++)
+		{
+			const double dX = pdX[s];
+			dPrevOut = dX - dPrevIn + m_dHighpass * dPrevOut;
+			dPrevIn = dX;
+			pdX[s] = dPrevOut;
+		}
+		m_pdPrevIn[c] = dPrevIn;
+		m_pdPrevOut[c] = dPrevOut;
+	}
+}
+
+// the samples in the current basis: Y = V' X
+void ArtifactSubspaceReconstruction::Project(int nSamples)
+{
+	for (int i = 0; i < m_nChannels; i++)
+	{
+		double* pdY = &m_pdY[i * m_nCapacity];
+		std::fill_n(pdY, nSamples, 0.0);
+		for (int j = 0; j < m_nChannels; j++)
+		{
+			const double dV = m_pdV[j * m_nChannels + i];
+			const double* pdX = &m_pdIn[j * m_nCapacity];
+			for (int s = 0; s < nSamples; s++) pdY[s] += dV * pdX[s];
+		}
+	}
+}
+
+// Jacobi rotation of the basis that zeroes A(p, q); B follows into the same basis
+void ArtifactSubspaceReconstruction::Rotate(int nP, int nQ)
+{
+	const int n = m_nChannels;
+	const double dApq = m_pdA[nP * n + nQ];
+	const double dTheta = (m_pdA[nQ * n + nQ] - m_pdA[nP * n + nP]) / (2 * dApq);
+	const double dT =
+		(dTheta >= 0 ? 1.0 : -1.0) / (std::fabs(dTheta) + std::sqrt(dTheta * dTheta + 1));
+	const double dC = 1 / std::sqrt(dT * dT + 1), dS = dT * dC;
+	for (auto* pMatrix : {&m_pdA, &m_pdB})
+	{
+		if (pMatrix == &m_pdB && m_phase != Running) break;
+		double* pdM = pMatrix->data();
+		for (int k = 0; k < n; k++)
+		{
+			const double dKp = pdM[k * n + nP], dKq = pdM[k * n + nQ];
+			pdM[k * n + nP] = dC * dKp - dS * dKq;
+			pdM[k * n + nQ] = dS * dKp + dC * dKq;
+		}
+		for (int k = 0; k < n; k++)
+		{
+			const double dPk = pdM[nP * n + k], dQk = pdM[nQ * n + k];
+			pdM[nP * n + k] = dC * dPk - dS * dQk;
+			pdM[nQ * n + k] = dS * dPk + dC * dQk;
+		}
+	}
+	m_pdA[nP * n + nQ] = m_pdA[nQ * n + nP] = 0;
+	for (int k = 0; k < n; k++)
+	{
+		const double dKp = m_pdV[k * n + nP], dKq = m_pdV[k * n + nQ];
+		m_pdV[k * n + nP] = dC * dKp - dS * dKq;
+		m_pdV[k * n + nQ] = dS * dKp + dC * dKq;
+	}
+}
+
+// rotates the pairs of components that are correlated by more than dTolerance, starting
+// where the last sweep stopped; returns the number of rotations
+int ArtifactSubspaceReconstruction::Sweep(double dTolerance, int nMaxRotations)
+{
+	const int n = m_nChannels;
+	int nRotations = 0;
+	for (int r = 0; r < n - 1; r++)
+	{
+		const int p = (m_nRotationCursor + r) % (n - 1);
+		for (int q = p + 1; q < n; q++)
+		{
+			const double dApq = m_pdA[p * n + q];
+			const double dScale = std::sqrt(std::fabs(m_pdA[p * n + p] * m_pdA[q * n + q]));
+			if (dApq != 0 && std::fabs(dApq) > dTolerance * dScale)
+			{
+				Rotate(p, q);
+				nRotations++;
+			}
+		}
+		if (nRotations >= nMaxRotations)
+		{
+			m_nRotationCursor = (p + 1) % (n - 1);
+			break;
+		}
+	}
+	return nRotations;
+}
+
+void ArtifactSubspaceReconstruction::FinishCovariance()
+{
+	const int n = m_nChannels;
+	for (int i = 0; i < n; i++)
+		for (int k = i; k < n; k++)
+			m_pdReference[k * n + i] = m_pdReference[i * n + k] /=
+				static_cast<double>(m_nPhaseSamples);
+	// the only full eigendecomposition: cyclic Jacobi sweeps until the basis is diagonal
+	m_pdA = m_pdReference;
+	std::fill(m_pdV.begin(), m_pdV.end(), 0.0);
+	for (int i = 0; i < n; i++) m_pdV[i * n + i] = 1;
+	for (int nSweep = 0; nSweep < 50 && n > 1 && Sweep(1e-12, n * n) > 0; nSweep++)
+		;
+	// the reconstruction only needs the inverse, V diag(1 / d) V', with the eigenvalues d
+	// bounded below for channels that are (nearly) linearly dependent
+	double dLargest = 0;
+	for (int j = 0; j < n; j++) dLargest = std::max(dLargest, m_pdA[j * n + j]);
+	for (int j = 0; j < n; j++) m_pdS[j] = 1 / std::max(m_pdA[j * n + j], 1e-12 * dLargest);
+	for (int i = 0; i < n; i++)
+		for (int k = i; k < n; k++)
+		{
+			double dSum = 0;
+			for (int j = 0; j < n; j++) dSum += m_pdV[i * n + j] * m_pdS[j] * m_pdV[k * n + j];
+			m_pdReference[k * n + i] = m_pdReference[i * n + k] = dSum;
+		}
+	m_phase = Thresholds;
+	m_nPhaseSamples = 0;
+}
+
+void ArtifactSubspaceReconstruction::FinishThresholds()
+{
+	const int n = m_nChannels;
+	std::fill(m_pdB.begin(), m_pdB.end(), 0.0);
+	for (int i = 0; i < n; i++)
+	{
+		// median and median absolute deviation of the component's window RMS
+		for (int w = 0; w < m_nWindows; w++) m_pdMedian[w] = m_pdWindowRms[w * n + i];
+		auto pMiddle = m_pdMedian.begin() + m_nWindows / 2;
+		std::nth_element(m_pdMedian.begin(), pMiddle, m_pdMedian.begin() + m_nWindows);
+		const double dMedian = *pMiddle;
+		for (int w = 0; w < m_nWindows; w++) m_pdMedian[w] = std::fabs(m_pdMedian[w] - dMedian);
+		std::nth_element(m_pdMedian.begin(), pMiddle, m_pdMedian.begin() + m_nWindows);
+		const double dThreshold = dMedian + m_dCutoff * 1.4826 * *pMiddle;
+		// thresholds are compared with variances
+		m_pdB[i * n + i] = dThreshold * dThreshold;
+	}
+	m_phase = Running;
+}
+
+void ArtifactSubspaceReconstruction::Track(int nSamples)
+{
+	const int n = m_nChannels;
+	Project(nSamples);
+	const double dAlpha = std::exp(-nSamples / (dCovarianceTime * m_dRate));
+	const double dBeta = (1 - dAlpha) / nSamples;
+	for (int i = 0; i < n; i++)
+	{
+		const double* pdYi = &m_pdY[i * m_nCapacity];
+		for (int k = i; k < n; k++)
+		{
+			const double* pdYk = &m_pdY[k * m_nCapacity];
+			double dDot = 0;
+			for (int s = 0; s < nSamples; s++) dDot += pdYi[s] * pdYk[s];
+			m_pdA[k * n + i] = m_pdA[i * n + k] = dAlpha * m_pdA[i * n + k] + dBeta * dDot;
+		}
+	}
+	if (n > 1) Sweep(dTrackingTolerance, 2 * n);
+
+	// components above their threshold, but never more than m_nMaxRejected of the largest
+	m_pnCandidates.clear();
+	for (int i = 0; i < n; i++)
+		if (m_pdA[i * n + i] > m_pdB[i * n + i]) m_pnCandidates.push_back(i);
+	if (static_cast<int>(m_pnCandidates.size()) > m_nMaxRejected)
+	{
+		std::nth_element(m_pnCandidates.begin(), m_pnCandidates.begin() + m_nMaxRejected,
+			m_pnCandidates.end(), [this, n](int a, int b) {
+				return m_pdA[a * n + a] > m_pdA[b * n + b];
+			});
+		m_pnCandidates.resize(m_nMaxRejected);
+	}
+	m_prevKeep.swap(m_keep);
+	std::fill(m_keep.begin(), m_keep.end(), 1);
+	for (int i : m_pnCandidates) m_keep[i] = 0;
+
+	m_nSinceRebuild += nSamples;
+	const bool bRebuild =
+		m_keep != m_prevKeep ||
+		(!m_pnCandidates.empty() && m_nSinceRebuild >= dRebuildInterval * m_dRate);
+	if (bRebuild)
+	{
+		std::swap(m_previous, m_current);
+		Rebuild();
+		m_nSinceRebuild = 0;
+	}
+	Reconstruct(m_current, nSamples, m_pdOut.data());
+	// the new reconstruction fades in over the block
+	if (bRebuild && (m_current.nRejected || m_previous.nRejected))
+	{
+		Reconstruct(m_previous, nSamples, m_pdBlend.data());
+		for (int c = 0; c < n; c++)
+		{
+			double* pdOut = &m_pdOut[c * m_nCapacity];
+			const double* pdOld = &m_pdBlend[c * m_nCapacity];
+			for (int s = 0; s < nSamples; s++)
+			{
+				const double dW = 0.5 - 0.5 * std::cos(3.14159265358979 * (s + 1) / nSamples);
+				pdOut[s] = dW * pdOut[s] + (1 - dW) * pdOld[s];
+			}
+		}
+	}
+}
+
+// The offline reconstruction matrix M pinv(keep .* V' M) V' with the mixing matrix M =
+// sqrtm(S) of the reference covariance S is the conditional mean of the rejected components
+// given the kept ones, which works out to I - Vr (Vr' S^-1 Vr)^-1 Vr' S^-1. With r rejected
+// components, building it costs channels^2 * r and applying it channels * r per sample.
+void ArtifactSubspaceReconstruction::Rebuild()
+{
+	const int n = m_nChannels;
+	const int r = static_cast<int>(m_pnCandidates.size());
+	m_current.nRejected = r;
+	std::vector<double>& pdVrT = m_current.pdVrT;
+	std::vector<double>& pdM = m_current.pdM;
+	// Vr' and Z = Vr' S^-1 (in pdM), r x n
+	for (int a = 0; a < r; a++)
+	{
+		double* pdZ = &pdM[a * n];
+		std::fill_n(pdZ, n, 0.0);
+		for (int l = 0; l < n; l++)
+		{
+			const double dV = pdVrT[a * n + l] = m_pdV[l * n + m_pnCandidates[a]];
+			const double* pdInverse = &m_pdReference[l * n];
+			for (int c = 0; c < n; c++) pdZ[c] += dV * pdInverse[c];
+		}
+	}
+	// G = Z Vr (r x r, in m_pdS) and its Cholesky factor L in place
+	for (int a = 0; a < r; a++)
+		for (int b = 0; b <= a; b++)
+		{
+			double dSum = 0;
+			for (int c = 0; c < n; c++) dSum += pdM[a * n + c] * pdVrT[b * n + c];
+			m_pdS[a * n + b] = dSum;
+		}
+	for (int a = 0; a < r; a++)
+		for (int b = 0; b <= a; b++)
+		{
+			double dSum = m_pdS[a * n + b];
+			for (int k = 0; k < b; k++) dSum -= m_pdS[a * n + k] * m_pdS[b * n + k];
+			m_pdS[a * n + b] =
+				a == b ? std::sqrt(std::max(dSum, 1e-300)) : dSum / m_pdS[b * n + b];
+		}
+	// M = G^-1 Z, by forward and back substitution on whole rows
+	for (int a = 0; a < r; a++)
+	{
+		double* pdRow = &pdM[a * n];
+		for (int k = 0; k < a; k++)
+		{
+			const double dL = m_pdS[a * n + k];
+			const double* pdRowK = &pdM[k * n];
+			for (int c = 0; c < n; c++) pdRow[c] -= dL * pdRowK[c];
+		}
+		const double dScale = 1 / m_pdS[a * n + a];
+		for (int c = 0; c < n; c++) pdRow[c] *= dScale;
+	}
+	for (int a = r - 1; a >= 0; a--)
+	{
+		double* pdRow = &pdM[a * n];
+		for (int k = a + 1; k < r; k++)
+		{
+			const double dL = m_pdS[k * n + a];
+			const double* pdRowK = &pdM[k * n];
+			for (int c = 0; c < n; c++) pdRow[c] -= dL * pdRowK[c];
+		}
+		const double dScale = 1 / m_pdS[a * n + a];
+		for (int c = 0; c < n; c++) pdRow[c] *= dScale;
+	}
+}
+
+// pdOut = X - Vr (M X), with M X in m_pdY
+void ArtifactSubspaceReconstruction::Reconstruct(
+	const Reconstruction& reconstruction, int nSamples, double* pdOut)
+{
+	const int n = m_nChannels;
+	for (int a = 0; a < reconstruction.nRejected; a++)
+	{
+		double* pdT = &m_pdY[a * m_nCapacity];
+		std::fill_n(pdT, nSamples, 0.0);
+		for (int c = 0; c < n; c++)
+		{
+			const double dM = reconstruction.pdM[a * n + c];
+			const double* pdX = &m_pdIn[c * m_nCapacity];
+			for (int s = 0; s < nSamples; s++) pdT[s] += dM * pdX[s];
+		}
+	}
+	for (int c = 0; c < n; c++)
+	{
+		double* pdOutC = pdOut + c * m_nCapacity;
+		std::copy_n(&m_pdIn[c * m_nCapacity], nSamples, pdOutC);
+		for (int a = 0; a < reconstruction.nRejected; a++)
+		{
+			const double dV = reconstruction.pdVrT[a * n + c];
+			const double* pdT = &m_pdY[a * m_nCapacity];
+			for (int s = 0; s < nSamples; s++) pdOutC[s] -= dV * pdT[s];
+		}
+	}
+}
+
+void ArtifactSubspaceReconstruction::Process(int nSamples)
+{
+	if (nSamples <= 0) return;
+	Highpass(nSamples);
+	const int n = m_nChannels;
+	switch (m_phase)
+	{
+	case Covariance:
+		for (int i = 0; i < n; i++)
+		{
+			const double* pdXi = &m_pdIn[i * m_nCapacity];
+			for (int k = i; k < n; k++)
+			{
+				const double* pdXk = &m_pdIn[k * m_nCapacity];
+				double dDot = 0;
+				for (int s = 0; s < nSamples; s++) dDot += pdXi[s] * pdXk[s];
+				m_pdReference[i * n + k] += dDot;
+			}
+		}
+		std::copy_n(m_pdIn.begin(), m_pdIn.size(), m_pdOut.begin());
+		m_nPhaseSamples += nSamples;
+		if (m_nPhaseSamples >= m_nPhaseLen) FinishCovariance();
+		break;
+	case Thresholds:
+		Project(nSamples);
+		for (int s = 0; s < nSamples; s++)
+		{
+			for (int i = 0; i < n; i++)
+			{
+				const double dY = m_pdY[i * m_nCapacity + s];
+				m_pdWindowSum[i] += dY * dY;
+			}
+			if (++m_nWindowPos == m_nWindowLen)
+			{
+				if (m_nWindows * static_cast<std::size_t>(n) < m_pdWindowRms.size())
+				{
+					for (int i = 0; i < n; i++)
+						m_pdWindowRms[m_nWindows * n + i] =
+						std::sqrt(m_pdWindowSum[i] / m_nWindowLen);
+					m_nWindows++;
+				}
+				std::fill(m_pdWindowSum.begin(), m_pdWindowSum.end(), 0.0);
+				m_nWindowPos = 0;
+			}
+		}
+		std::copy_n(m_pdIn.begin(), m_pdIn.size(), m_pdOut.begin());
+		m_nPhaseSamples += nSamples;
+		if (m_nPhaseSamples >= m_nPhaseLen && m_nWindows > 0) FinishThresholds();
+		break;
+	case Running:
+		Track(nSamples);
+		break;
+	}
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+// Online artifact subspace reconstruction (ASR) for a bank of channels at one output rate.
+// A calibration segment at the start of the acquisition, which should be free of artifacts,
+// gives the reference covariance and a threshold for every principal component (the median
+// plus dCutoff robust standard deviations of its RMS in 0.5 s windows). Afterwards the
+// covariance of the incoming data is tracked with exponential forgetting, and components whose
+// variance exceeds their threshold are rejected and reconstructed from the others through the
+// reference covariance.
+//
+// Instead of a full eigendecomposition per block, the covariance and the threshold matrix are
+// kept in the current eigenbasis: each block adds a rank-nSamples update there, and a bounded
+// number of Jacobi rotations brings the basis back to diagonal, so the cost per block is of
+// the order of channels^2 * samples. The reconstruction is a rank-r correction for r rejected
+// components; it's rebuilt when they change (and every 0.1 s while there are any) and blended
+// in over one block. All memory is allocated in the constructor.
+//
+// Simplifications against the offline method: a one-pole high-pass instead of the spectral
+// weighting filter, a median/MAD fit instead of the truncated generalized Gaussian, and no
+// look-ahead, so the cleaning adds no latency.
+class ArtifactSubspaceReconstruction
+{
+private:
+	enum Phase { Covariance, Thresholds, Running };
+
+	// x - Vr M x with the rejected components Vr and M = (Vr' S^-1 Vr)^-1 Vr' S^-1, where S
+	// is the reference covariance
+	struct Reconstruction
+	{
+		int nRejected;
+		std::vector<double> pdVrT, pdM; // nRejected x channels, row-major
+	};
+
+	int m_nChannels, m_nCapacity;
+	int m_nMaxRejected; // at most this many components are reconstructed
+	double m_dRate, m_dCutoff;
+	double m_dHighpass; // pole of the DC blocker
+	Phase m_phase;
+
+	std::vector<double> m_pdIn, m_pdOut, m_pdY, m_pdBlend; // channel-major blocks
+	std::vector<double> m_pdPrevIn, m_pdPrevOut;		   // high-pass state
+
+	// calibration
+	int64_t m_nPhaseLen, m_nPhaseSamples; // samples per calibration phase, and so far
+	int m_nWindowLen, m_nWindowPos, m_nWindows;
+	std::vector<double> m_pdWindowSum, m_pdWindowRms; // per component; windows x components
+	std::vector<double> m_pdMedian;					  // scratch for the robust fit
+
+	// channels x channels, row-major: the reference covariance (inverted once its eigenbasis
+	// is known), and the tracked covariance A and the thresholds B in the basis V, whose
+	// column i is component i
+	std::vector<double> m_pdReference, m_pdA, m_pdB, m_pdV, m_pdS;
+	Reconstruction m_current, m_previous;
+	std::vector<int> m_pnCandidates;
+	std::vector<char> m_keep, m_prevKeep;
+	int64_t m_nSinceRebuild;
+	int m_nRotationCursor;
+
+	void Highpass(int nSamples);
+	void Project(int nSamples);
+	void Rotate(int nP, int nQ);
+	int Sweep(double dTolerance, int nMaxRotations);
+	void FinishCovariance();
+	void FinishThresholds();
+	void Track(int nSamples);
+	void Rebuild();
+	void Reconstruct(const Reconstruction& reconstruction, int nSamples, double* pdOut);
+
+public:
+	// dCalibration: seconds of clean data at the start, half for the covariance and half for
+	// the thresholds; dCutoff: rejection threshold in robust standard deviations
+	ArtifactSubspaceReconstruction(int nChannels, double dSamplingRate, int nMaxBlockLen,
+		double dCalibration = 60.0, double dCutoff = 20.0, double dHighpass = 0.5);
+
+	// channel-major input buffer in microvolts, fill up to nMaxBlockLen samples per channel
+	// before Process()
+	double* Input(int nChannel) { return &m_pdIn[nChannel * m_nCapacity]; }
+	void Process(int nSamples);
+	// the high-passed and, once calibrated, cleaned samples of the last block
+	const double* Output(int nChannel) const { return &m_pdOut[nChannel * m_nCapacity]; }
+
+	bool Calibrated() const { return m_phase == Running; }
+	// components reconstructed in the last block
+	int Rejected() const { return m_current.nRejected; }
+};
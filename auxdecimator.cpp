@@ -0,0 +1,35 @@
+#include "auxdecimator.h"
+
+AuxDecimator::AuxDecimator(int nChannels, int nFactor, int nMaxBlockLen)
+	: m_nChannels(nChannels), m_nFactor(nFactor), m_nCapacity(nMaxBlockLen / nFactor + 1),
+	  m_nPhase(0), m_nCount(0), m_pnIntegrator1(nChannels, 0), m_pnIntegrator2(nChannels, 0),
+	  m_pnComb1(nChannels, 0), m_pnComb2(nChannels, 0),
+	  m_pdOut(static_cast<std::size_t>(m_nCapacity) * nChannels)
+{
+}
+
+void AuxDecimator::Process(
+	const int16_t* pData, int nStride, const unsigned int* pnChannels, int nSamples)
+{
+	const double dGain = 1.0 / (static_cast<double>(m_nFactor) * m_nFactor);
+	m_nCount = 0;
+	for (int s = 0; s < nSamples; s++, pData += nStride)
+	{
+		for (int c = 0; c < m_nChannels; c++)
+		{
+			m_pnIntegrator1[c] += static_cast<uint64_t>(static_cast<int64_t>(pData[pnChannels[c]]));
+			m_pnIntegrator2[c] += m_pnIntegrator1[c];
+		}
+		if (++m_nPhase < m_nFactor) continue;
+		m_nPhase = 0;
+		double* pdOut = &m_pdOut[static_cast<std::size_t>(m_nCount++) * m_nChannels];
+		for (int c = 0; c < m_nChannels; c++)
+		{
+			const uint64_t nDiff1 = m_pnIntegrator2[c] - m_pnComb1[c];
+			m_pnComb1[c] = m_pnIntegrator2[c];
+			const uint64_t nDiff2 = nDiff1 - m_pnComb2[c];
+			m_pnComb2[c] = nDiff1;
+			pdOut[c] = static_cast<int64_t>(nDiff2) * dGain;
+		}
+	}
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+// Decimator for slow auxiliary signals (GSR, respiration, temperature on the PolyBox) that
+// need neither the EEG filters nor their rates: a second order CIC filter, i.e. two running
+// sums at the hardware rate and two differences per output sample, all in integers. That is
+// two additions per input sample and channel regardless of the factor, against a cascade of
+// IIR stages for the EEG, at the price of a sinc^2 response that is only suited to signals far
+// below the output rate. Works on the raw multiplexed amplifier samples, so the AUX channels
+// never enter the EEG decimation tree.
+class AuxDecimator
+{
+private:
+	static const int order = 2;
+
+	int m_nChannels, m_nFactor, m_nCapacity;
+	int m_nPhase; // input samples since the last output sample
+	int m_nCount; // output samples of the last block
+	// integrators and combs per channel; unsigned, so their wrap-around is defined and cancels
+	// in the differences
+	std::vector<uint64_t> m_pnIntegrator1, m_pnIntegrator2, m_pnComb1, m_pnComb2;
+	std::vector<double> m_pdOut; // multiplexed
+
+public:
+	// nFactor: hardware samples per output sample; nMaxBlockLen: most input samples per block
+	AuxDecimator(int nChannels, int nFactor, int nMaxBlockLen);
+
+	// pData: nSamples multiplexed samples of nStride words, of which words pnChannels[0 ..
+	// nChannels) are decimated
+	void Process(const int16_t* pData, int nStride, const unsigned int* pnChannels, int nSamples);
+
+	// OutputCount() multiplexed samples of the last block, in amplifier counts
+	const double* Output() const { return m_pdOut.data(); }
+	int OutputCount() const { return m_nCount; }
+	int OutputCapacity() const { return m_nCapacity; }
+	// input samples between the centre of the last output's window (the filter delay) and the
+	// end of the last block
+	double OutputLag() const { return m_nPhase + order * (m_nFactor - 1) / 2.0; }
+};
@@ -0,0 +1,75 @@
+// Measures the cost per block of the online artifact subspace reconstruction for a range of
+// channel counts, so the block period of a configuration can be checked against it. The
+// pseudo EEG is a random mixture of noise sources with a blink-like artifact every 5 s; the
+// calibration (including its one eigendecomposition) is timed separately.
+//
+// usage: asr_benchmark [rate=500] [block=10] [seconds=60] [calibration=30]
+#include "artifactsubspace.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+int main(int argc, char *argv[]) {
+	const int rate = argc > 1 ? std::atoi(argv[1]) : 500;
+	const int block_len = argc > 2 ? std::atoi(argv[2]) : 10;
+	const double seconds = argc > 3 ? std::atof(argv[3]) : 60.0;
+	const double calibration = argc > 4 ? std::atof(argv[4]) : 30.0;
+	const double period_us = 1e6 * block_len / rate;
+	std::printf("%d Hz, blocks of %d samples (%.0f us), %.0f s calibration + %.0f s\n\n", rate,
+		block_len, period_us, calibration, seconds);
+	std::printf("%8s %14s %10s %10s %10s %10s %8s\n", "channels", "calibration ms", "mean us",
+		"p99 us", "max us", "rebuild us", "load");
+
+	for (int channels : {8, 16, 32, 64, 128, 256}) {
+		ArtifactSubspaceReconstruction asr(channels, rate, block_len, calibration);
+		std::mt19937 rng(1);
+		std::normal_distribution<double> noise(0.0, 10.0);
+		std::vector<double> mixing(static_cast<size_t>(channels) * channels), blink(channels);
+		for (auto &m : mixing) m = noise(rng) / 10;
+		for (int c = 0; c < channels; c++) blink[c] = std::exp(-c / 8.0);
+		std::vector<double> sources(channels);
+		std::vector<double> times;
+		double calibration_seconds = 0, rebuild_max = 0;
+		long long n = 0;
+		const auto calibration_blocks = static_cast<long long>(calibration * rate / block_len);
+		const auto blocks = calibration_blocks + static_cast<long long>(seconds * rate / block_len);
+		for (long long b = 0; b < blocks; b++) {
+			for (int s = 0; s < block_len; s++, n++) {
+				for (auto &source : sources) source = noise(rng);
+				const double t = static_cast<double>(n) / rate, phase = std::fmod(t, 5.0);
+				const double artifact = t > calibration && phase < 0.4
+											? 800 * std::sin(3.14159265 * phase / 0.4)
+											: 0;
+				for (int c = 0; c < channels; c++) {
+					double value = artifact * blink[c];
+					for (int k = 0; k < channels; k++)
+						value += mixing[c * channels + k] * sources[k];
+					asr.Input(c)[s] = value;
+				}
+			}
+			const int rejected = asr.Rejected();
+			const auto start = std::chrono::steady_clock::now();
+			asr.Process(block_len);
+			const double elapsed =
+				std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			if (b < calibration_blocks)
+				calibration_seconds += elapsed;
+			else {
+				times.push_back(elapsed);
+				if (rejected != asr.Rejected()) rebuild_max = std::max(rebuild_max, elapsed);
+			}
+		}
+		double sum = 0;
+		for (double t : times) sum += t;
+		const double mean_us = 1e6 * sum / times.size();
+		std::sort(times.begin(), times.end());
+		std::printf("%8d %14.1f %10.1f %10.1f %10.1f %10.1f %7.1f%%\n", channels,
+			1e3 * calibration_seconds, mean_us, 1e6 * times[times.size() * 99 / 100],
+			1e6 * times.back(), 1e6 * rebuild_max, 100 * mean_us / period_us);
+	}
+	return 0;
+}
@@ -0,0 +1,203 @@
+// End-to-end latency: how old a sample is when a consumer receives it from the app's data
+// outlet, for every combination of chunk size, sample format and sampling rate. The app is
+// driven through its control endpoint and acquires from the simulated amplifier (on Linux and
+// OS X), which paces its samples by the system clock like the real one; the consumer is a
+// stream_inlet in this process on the same host, so both sides read the same clock.
+//
+// The app stamps each block when ReadFile returns it, and each sample back from there by its
+// distance from the end of the block, so for every received sample this reports:
+// - age: receive time minus its time stamp, which includes waiting for the rest of its chunk
+// - newest: the same for the last sample of every chunk, i.e. from ReadFile to the consumer
+//
+// usage: latency_benchmark [--start <app>] [--name BrainAmpSeries] [--stream BrainAmpSeries-1]
+//                          [--channels 32] [--chunk-sizes 1,4,16,32,128]
+//                          [--rates 500,1000,5000] [--formats int16,float32] [--seconds 10]
+//                          [--warm-up 2]
+#include <QCoreApplication>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLocalSocket>
+#include <QProcess>
+#include <QThread>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <lsl_cpp.h>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static QLocalSocket *socket = nullptr;
+
+static QJsonObject request(const QJsonObject &object) {
+	socket->write(QJsonDocument(object).toJson(QJsonDocument::Compact) + '\n');
+	socket->waitForBytesWritten(1000);
+	while (!socket->canReadLine())
+		if (!socket->waitForReadyRead(30000)) {
+			std::printf("no reply from the app\n");
+			std::exit(2);
+		}
+	return QJsonDocument::fromJson(socket->readLine()).object();
+}
+
+static std::vector<std::string> split(const std::string &list) {
+	std::vector<std::string> items;
+	std::istringstream stream(list);
+	for (std::string item; std::getline(stream, item, ',');)
+		if (!item.empty()) items.push_back(item);
+	return items;
+}
+
+// p-th percentile in ms of latencies in seconds, sorted in place
+static double percentile_ms(std::vector<double> &latencies, double p) {
+	if (latencies.empty()) return 0;
+	const std::size_t k = std::min(latencies.size() - 1,
+		static_cast<std::size_t>(p * static_cast<double>(latencies.size())));
+	std::nth_element(latencies.begin(), latencies.begin() + k, latencies.end());
+	return 1000 * latencies[k];
+}
+
+// waits for the data outlet of the new configuration; the outlet of the previous one has the
+// same name and may still be announced for a moment
+static bool resolve(const std::string &name, double rate, lsl::channel_format_t format,
+	lsl::stream_info &result) {
+	for (int attempt = 0; attempt < 20; attempt++) {
+		for (const auto &info : lsl::resolve_stream("name", name, 1, 1.0))
+			if (info.nominal_srate() == rate && info.channel_format() == format) {
+				result = info;
+				return true;
+			}
+		QThread::msleep(250);
+	}
+	return false;
+}
+
+// receives samples for the given time and collects their latencies; every chunk arrives at
+// once, so the samples received together up to the first empty pull are one chunk
+template <typename T>
+static void measure(lsl::stream_inlet &inlet, int channels, double warm_up, double seconds,
+	std::vector<double> &ages, std::vector<double> &newest) {
+	std::vector<T> sample(channels);
+	const double correction = inlet.time_correction(5.0);
+	const double start = lsl::local_clock();
+	while (lsl::local_clock() - start < warm_up) inlet.pull_sample(sample, 0.1);
+	while (lsl::local_clock() - start < warm_up + seconds) {
+		double timestamp = inlet.pull_sample(sample, 0.1);
+		double received = lsl::local_clock();
+		double last_age = 0;
+		while (timestamp != 0.0) {
+			last_age = received - (timestamp + correction);
+			ages.push_back(last_age);
+			timestamp = inlet.pull_sample(sample, 0.0);
+			if (timestamp != 0.0) received = lsl::local_clock();
+		}
+		if (last_age != 0) newest.push_back(last_age);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	QCoreApplication app(argc, argv);
+	std::map<std::string, std::string> options{{"name", "BrainAmpSeries"},
+		{"stream", "BrainAmpSeries-1"}, {"channels", "32"}, {"chunk-sizes", "1,4,16,32,128"},
+		{"rates", "500,1000,5000"}, {"formats", "int16,float32"}, {"seconds", "10"},
+		{"warm-up", "2"}, {"start", ""}};
+	for (int k = 1; k + 1 < argc; k += 2) {
+		const std::string key = std::string(argv[k]).substr(2);
+		if (std::string(argv[k]).compare(0, 2, "--") || !options.count(key)) {
+			std::printf("unknown option %s\n", argv[k]);
+			return 2;
+		}
+		options[key] = argv[k + 1];
+	}
+	auto number = [&](const char *key) { return std::atof(options[key].c_str()); };
+
+	QProcess process;
+	if (!options["start"].empty()) {
+		process.setProgram(QString::fromStdString(options["start"]));
+		process.setArguments({"--control", QString::fromStdString(options["name"])});
+		process.setProcessChannelMode(QProcess::ForwardedChannels);
+		process.start();
+		if (!process.waitForStarted()) {
+			std::printf("could not start %s\n", options["start"].c_str());
+			return 2;
+		}
+	}
+	QLocalSocket connection;
+	socket = &connection;
+	for (int attempt = 0; attempt < 100; attempt++) {
+		socket->connectToServer(QString::fromStdString(options["name"]));
+		if (socket->waitForConnected(100)) break;
+		QThread::msleep(100);
+	}
+	if (socket->state() != QLocalSocket::ConnectedState) {
+		std::printf("could not connect to the app: %s\n",
+			socket->errorString().toStdString().c_str());
+		return 2;
+	}
+
+	// only the primary data stream, with nothing else on the reader thread
+	const int channels = static_cast<int>(number("channels"));
+	QJsonArray labels;
+	for (int c = 1; c <= channels; c++) labels.append(QString::number(c));
+	request(QJsonObject{{"command", "unlink"}});
+	QJsonObject reply = request(QJsonObject{{"command", "reconfigure"},
+		{"settings", QJsonObject{{"channelcount", channels}, {"latencybudget", 0},
+						 {"additionalrates", QJsonArray()}, {"usepolybox", false},
+						 {"channels/montage", QJsonArray()}, {"channels/labels", labels}}}});
+	if (!reply["ok"].toBool()) {
+		std::printf("could not configure the app: %s\n",
+			reply["error"].toString().toStdString().c_str());
+		return 2;
+	}
+
+	int errors = 0;
+	std::printf("%6s %8s %6s %9s %8s %8s %8s %8s %8s %8s\n", "rate", "format", "chunk",
+		"samples", "age p50", "p99", "max", "new p50", "p99", "max");
+	for (const auto &rate : split(options["rates"]))
+		for (const auto &format : split(options["formats"]))
+			for (const auto &chunk : split(options["chunk-sizes"])) {
+				const bool raw = format == "int16";
+				request(QJsonObject{{"command", "unlink"}});
+				reply = request(QJsonObject{{"command", "reconfigure"},
+					{"settings", QJsonObject{{"samplingrate", std::atoi(rate.c_str())},
+									 {"chunksize", std::atoi(chunk.c_str())},
+									 {"sendrawstream", raw}}}});
+				if (reply["ok"].toBool()) reply = request(QJsonObject{{"command", "link"}});
+				lsl::stream_info info;
+				if (!reply["ok"].toBool() ||
+					!resolve(options["stream"], std::atof(rate.c_str()),
+						raw ? lsl::cf_int16 : lsl::cf_float32, info)) {
+					std::printf("%6s %8s %6s   failed: %s\n", rate.c_str(), format.c_str(),
+						chunk.c_str(), reply["error"].toString().toStdString().c_str());
+					errors++;
+					continue;
+				}
+				std::vector<double> ages, newest;
+				{
+					lsl::stream_inlet inlet(info);
+					inlet.open_stream(5.0);
+					if (raw)
+						measure<int16_t>(inlet, info.channel_count(), number("warm-up"),
+							number("seconds"), ages, newest);
+					else
+						measure<float>(inlet, info.channel_count(), number("warm-up"),
+							number("seconds"), ages, newest);
+				}
+				std::printf("%6s %8s %6s %9zu %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f\n",
+					rate.c_str(), format.c_str(), chunk.c_str(), ages.size(),
+					percentile_ms(ages, 0.5), percentile_ms(ages, 0.99),
+					percentile_ms(ages, 1.0), percentile_ms(newest, 0.5),
+					percentile_ms(newest, 0.99), percentile_ms(newest, 1.0));
+				std::fflush(stdout);
+			}
+	request(QJsonObject{{"command", "unlink"}});
+
+	socket->disconnectFromServer();
+	if (!options["start"].empty()) {
+		process.terminate();
+		if (!process.waitForFinished(5000)) process.kill();
+	}
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,118 @@
+// Compares the cost of the decimation paths for one block-wise acquisition: the original
+// per-channel Downsampler, the shared DecimationTree with an integer factor, and rational
+// resampling to a rate that does not divide 5000 Hz, with and without integer pre-decimation.
+//
+// usage: resampler_benchmark [channels=64] [seconds=60] [block=100]
+#include "decimationtree.h"
+#include "downsampler.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <vector>
+
+static const int hardware_rate = 5000;
+
+struct Result {
+	double seconds;
+	long long outputs; // per channel
+};
+
+// feeds the same pseudo EEG into process(block) and times only the processing
+static Result run(int channels, int blocks, int block_len,
+	const std::function<void(const std::vector<double> &, int)> &process,
+	const std::function<long long()> &outputs) {
+	std::mt19937 rng(1);
+	std::normal_distribution<double> noise(0.0, 50.0);
+	std::vector<double> input(static_cast<size_t>(channels) * block_len);
+	double elapsed = 0.0;
+	for (int b = 0; b < blocks; b++) {
+		for (int c = 0; c < channels; c++)
+			for (int s = 0; s < block_len; s++)
+				input[c * block_len + s] =
+					200.0 * std::sin(2 * 3.14159265 * 10.0 * (b * block_len + s) / hardware_rate) +
+					noise(rng);
+		auto start = std::chrono::steady_clock::now();
+		process(input, block_len);
+		elapsed += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+	return {elapsed, outputs()};
+}
+
+static void report(const char *name, int channels, double data_seconds, const Result &r) {
+	const double per_sample = r.seconds / (static_cast<double>(r.outputs) * channels);
+	std::printf("%-46s %10.1f %12.2f %10.0fx\n", name, 1e9 * per_sample,
+		1e3 * r.seconds / data_seconds, data_seconds / r.seconds);
+}
+
+int main(int argc, char *argv[]) {
+	const int channels = argc > 1 ? std::atoi(argv[1]) : 64;
+	const double seconds = argc > 2 ? std::atof(argv[2]) : 60.0;
+	const int block_len = argc > 3 ? std::atoi(argv[3]) : 100;
+	const int blocks = static_cast<int>(seconds * hardware_rate / block_len);
+	const double data_seconds = static_cast<double>(blocks) * block_len / hardware_rate;
+	std::printf("%d channels, %.0f s at %d Hz, blocks of %d samples\n\n", channels, data_seconds,
+		hardware_rate, block_len);
+	std::printf("%-46s %10s %12s %11s\n", "path", "ns/sample", "ms/s of data", "realtime");
+
+	{
+		// the original path: one Downsampler per channel on a float copy of it
+		const int factor = 20;
+		std::vector<Downsampler<float>> downsamplers(
+			channels, Downsampler<float>(factor, block_len / factor));
+		std::vector<float> channel_data(block_len);
+		long long outputs = 0;
+		Result r = run(channels, blocks, block_len,
+			[&](const std::vector<double> &in, int n) {
+				for (int c = 0; c < channels; c++) {
+					for (int s = 0; s < n; s++) channel_data[s] = static_cast<float>(in[c * n + s]);
+					downsamplers[c].Downsample(channel_data.data());
+				}
+				outputs += n / factor;
+			},
+			[&]() { return outputs; });
+		report("Downsampler<float>, 5000 -> 250 Hz", channels, data_seconds, r);
+	}
+
+	struct TreeCase {
+		const char *name;
+		std::vector<int> rates;
+	};
+	for (const TreeCase &tc : {TreeCase{"DecimationTree, 5000 -> 250 Hz", {250}},
+			 TreeCase{"DecimationTree, 5000 -> 256 Hz (8 + 32/125)", {256}},
+			 TreeCase{"DecimationTree, 5000 -> 1000 + 250 + 256 Hz", {1000, 250, 256}}}) {
+		DecimationTree tree(channels, channels, hardware_rate, tc.rates, block_len);
+		long long outputs = 0;
+		Result r = run(channels, blocks, block_len,
+			[&](const std::vector<double> &in, int n) {
+				for (int c = 0; c < channels; c++)
+					std::copy_n(&in[c * n], n, tree.Input(c));
+				tree.Process(n);
+				for (std::size_t o = 0; o < tc.rates.size(); o++)
+					outputs += tree.OutputCount(static_cast<int>(o));
+			},
+			[&]() { return outputs; });
+		report(tc.name, channels, data_seconds, r);
+	}
+
+	{
+		// without pre-decimation the filter grows with the decimation ratio
+		RationalResampler resampler(256, hardware_rate, channels, channels, block_len);
+		std::vector<double> out(static_cast<size_t>(channels) * resampler.MaxOutputLen(block_len));
+		const int stride = resampler.MaxOutputLen(block_len);
+		long long outputs = 0;
+		Result r = run(channels, blocks, block_len,
+			[&](const std::vector<double> &in, int n) {
+				outputs += resampler.Process(in.data(), n, n, out.data(), stride);
+			},
+			[&]() { return outputs; });
+		char name[64];
+		std::snprintf(name, sizeof(name), "RationalResampler only, %d taps/phase",
+			resampler.TapsPerPhase());
+		report(name, channels, data_seconds, r);
+	}
+	return 0;
+}
@@ -0,0 +1,137 @@
+// Compares the shared memory ring with an LSL outlet and inlet on the same machine, for the
+// same multiplexed float chunks. Both run in this process, a writer thread against a reader
+// thread, which is the best case for LSL (no second process, the loopback interface only):
+// - latency: the writer sends a chunk every block period like the app does, the reader
+//   records how long after its time stamp each chunk arrives
+// - throughput: the writer sends as fast as it can, and the reader counts the samples it
+//   receives intact while the writer runs; both paths keep 2 s of data for a slow reader and
+//   drop the oldest beyond that, which shows up as lost chunks
+// The ring reader polls (yielding the CPU when there's nothing new), the inlet waits.
+//
+// usage: shared_memory_benchmark [channels=128] [rate=5000] [chunk=10] [seconds=10]
+#include "sharedmemoryring.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <lsl_cpp.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct Result {
+	std::vector<double> latencies; // seconds per chunk
+	double sent = 0, received = 0; // samples
+	double seconds = 0;
+};
+
+// data kept for a reader that falls behind
+static const double buffer_seconds = 2.0;
+
+static double percentile_us(std::vector<double> latencies, double p) {
+	if (latencies.empty()) return 0;
+	std::sort(latencies.begin(), latencies.end());
+	const auto k = std::min(latencies.size() - 1,
+		static_cast<std::size_t>(p * static_cast<double>(latencies.size())));
+	return 1e6 * latencies[k];
+}
+
+// sends chunks for the given time, every period seconds or (period 0) as fast as possible
+template <typename Send>
+static void write_chunks(
+	Send send, int channels, int chunk, double period, double seconds, Result &result) {
+	std::vector<float> data(static_cast<std::size_t>(channels) * chunk);
+	for (std::size_t k = 0; k < data.size(); k++) data[k] = static_cast<float>(k % 1000);
+	const double start = lsl::local_clock();
+	double next = start;
+	while (lsl::local_clock() - start < seconds) {
+		if (period > 0) {
+			next += period;
+			while (lsl::local_clock() < next) std::this_thread::yield();
+		}
+		send(data.data(), lsl::local_clock());
+		result.sent += chunk;
+	}
+	result.seconds = lsl::local_clock() - start;
+}
+
+static Result run_shared_memory(int channels, double rate, int chunk, double period,
+	double seconds) {
+	SharedMemoryWriter writer("SharedMemoryBenchmark", "SharedMemoryBenchmark", lsl::cf_float32,
+		channels, rate, chunk, static_cast<int>(buffer_seconds * rate / chunk) + 1);
+	SharedMemoryReader reader("SharedMemoryBenchmark");
+	Result result;
+	std::atomic<bool> done{false};
+	std::thread consumer([&]() {
+		std::vector<float> data(static_cast<std::size_t>(channels) * chunk);
+		SharedChunk received;
+		while (!done)
+			if (reader.Read(data.data(), received)) {
+				result.latencies.push_back(lsl::local_clock() - received.dTimestamp);
+				result.received += received.nSamples;
+			} else
+				std::this_thread::yield();
+	});
+	write_chunks([&](const float *data, double timestamp) {
+		writer.Write(data, chunk, timestamp);
+	}, channels, chunk, period, seconds, result);
+	done = true;
+	consumer.join();
+	return result;
+}
+
+static Result run_lsl(int channels, double rate, int chunk, double period, double seconds) {
+	lsl::stream_info info("SharedMemoryBenchmark", "EEG", channels, rate, lsl::cf_float32,
+		"SharedMemoryBenchmark");
+	lsl::stream_outlet outlet(info, 0, static_cast<int>(buffer_seconds));
+	std::vector<lsl::stream_info> results =
+		lsl::resolve_stream("source_id", "SharedMemoryBenchmark", 1, 10.0);
+	if (results.empty()) {
+		std::printf("the outlet wasn't found\n");
+		std::exit(2);
+	}
+	lsl::stream_inlet inlet(results[0], static_cast<int>(buffer_seconds));
+	inlet.open_stream(10.0);
+	Result result;
+	std::atomic<bool> done{false};
+	std::thread consumer([&]() {
+		std::vector<float> data(channels);
+		while (!done) {
+			const double stamp = inlet.pull_sample(data.data(), channels, 0.1);
+			if (stamp == 0.0) continue;
+			// the last sample of a chunk carries its time stamp, when none were lost
+			if (static_cast<long long>(++result.received) % chunk == 0)
+				result.latencies.push_back(lsl::local_clock() - stamp);
+		}
+	});
+	write_chunks([&](const float *data, double timestamp) {
+		outlet.push_chunk_multiplexed(data, static_cast<std::size_t>(channels) * chunk, timestamp);
+	}, channels, chunk, period, seconds, result);
+	done = true;
+	consumer.join();
+	return result;
+}
+
+static void print(const char *path, const char *mode, const Result &result) {
+	std::printf("%-14s %-10s %8.0f %8.0f %8.0f %12.3f %6.1f %%\n", path, mode,
+		percentile_us(result.latencies, 0.5), percentile_us(result.latencies, 0.99),
+		percentile_us(result.latencies, 1.0), result.received / result.seconds / 1e6,
+		result.sent ? 100 * (result.sent - result.received) / result.sent : 0.0);
+}
+
+int main(int argc, char *argv[]) {
+	const int channels = argc > 1 ? std::atoi(argv[1]) : 128;
+	const double rate = argc > 2 ? std::atof(argv[2]) : 5000.0;
+	const int chunk = argc > 3 ? std::atoi(argv[3]) : 10;
+	const double seconds = argc > 4 ? std::atof(argv[4]) : 10.0;
+	const double period = chunk / rate;
+	std::printf("%d channels, float32, chunks of %d samples every %.0f us, %.0f s each\n\n",
+		channels, chunk, 1e6 * period, seconds);
+	std::printf("%-14s %-10s %8s %8s %8s %12s %8s\n", "path", "mode", "p50 us", "p99 us",
+		"max us", "Msamples/s", "lost");
+	print("shared memory", "paced", run_shared_memory(channels, rate, chunk, period, seconds));
+	print("LSL", "paced", run_lsl(channels, rate, chunk, period, seconds));
+	print("shared memory", "unpaced", run_shared_memory(channels, rate, chunk, 0, seconds));
+	print("LSL", "unpaced", run_lsl(channels, rate, chunk, 0, seconds));
+	return 0;
+}
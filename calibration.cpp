@@ -0,0 +1,113 @@
+#include "calibration.h"
+#include <algorithm>
+#include <cmath>
+#include <complex>
+
+CalibrationAnalyzer::CalibrationAnalyzer(
+	int nChannels, double dSamplingRate, double dFrequency, double dUnitScale, double dSettle)
+	: m_nChannels(nChannels), m_nStride(nChannels + 1), m_dSamplingRate(dSamplingRate),
+	  m_dFrequency(dFrequency), m_dUnitScale(dUnitScale),
+	  m_nSettle(static_cast<int64_t>(dSettle * dSamplingRate)), m_nSamples(0), m_dN(0), m_dC(0),
+	  m_dS(0), m_dCC(0), m_dCS(0), m_dSS(0), m_pdX(nChannels, 0), m_pdXC(nChannels, 0),
+	  m_pdXS(nChannels, 0)
+{
+}
+
+// one sample of all channels; __restrict and no branches so it vectorizes over the channels
+static void Accumulate(int nChannels, const int16_t* __restrict pnX, double dCos, double dSin,
+	double* __restrict pdX, double* __restrict pdXC, double* __restrict pdXS)
+{
+	for (int c = 0; c < nChannels; c++)
+	{
+		const double dX = static_cast<int32_t>(pnX[c]);
+		pdX[c] += dX;
+		pdXC[c] += dX * dCos;
+		pdXS[c] += dX * dSin;
+	}
+}
+
+static double Median(std::vector<double> pdValues)
+{
+	std::nth_element(pdValues.begin(), pdValues.begin() + pdValues.size() / 2, pdValues.end());
+	return pdValues[pdValues.size() / 2];
+}
+
+void CalibrationAnalyzer::Process(const int16_t* pnData, int nSamples)
+{
+	const double dPi = 3.14159265358979323846;
+	for (int s = 0; s < nSamples; s++, m_nSamples++, pnData += m_nStride)
+	{
+		if (m_nSamples < m_nSettle) continue;
+		// the phase is computed from the sample index, so it doesn't drift over long runs
+		const double dCycles = std::fmod(m_dFrequency * m_nSamples / m_dSamplingRate, 1.0);
+		const double dCos = std::cos(2 * dPi * dCycles), dSin = std::sin(2 * dPi * dCycles);
+		m_dN += 1;
+		m_dC += dCos;
+		m_dS += dSin;
+		m_dCC += dCos * dCos;
+		m_dCS += dCos * dSin;
+		m_dSS += dSin * dSin;
+		Accumulate(m_nChannels, pnData, dCos, dSin, m_pdX.data(), m_pdXC.data(), m_pdXS.data());
+	}
+}
+
+std::vector<ChannelCalibration> CalibrationAnalyzer::Result(
+	double dGainTolerance, double dPhaseTolerance) const
+{
+	const double dPi = 3.14159265358979323846;
+	std::vector<ChannelCalibration> result(m_nChannels, ChannelCalibration{0, 0, 0, false});
+	if (m_dN < 3) return result;
+
+	// invert the symmetric 3x3 normal matrix [N C S; C CC CS; S CS SS] once for all channels
+	const double dM[3][3] = {{m_dN, m_dC, m_dS}, {m_dC, m_dCC, m_dCS}, {m_dS, m_dCS, m_dSS}};
+	double dInv[3][3];
+	for (int i = 0; i < 3; i++)
+		for (int j = 0; j < 3; j++)
+		{
+			const int i1 = (j + 1) % 3, i2 = (j + 2) % 3, j1 = (i + 1) % 3, j2 = (i + 2) % 3;
+			dInv[i][j] = dM[i1][j1] * dM[i2][j2] - dM[i1][j2] * dM[i2][j1];
+		}
+	const double dDet = dM[0][0] * dInv[0][0] + dM[0][1] * dInv[1][0] + dM[0][2] * dInv[2][0];
+	if (std::fabs(dDet) < 1e-12) return result;
+
+	// x ~ offset + a cos + b sin = offset + A cos(wt + phi)
+	std::vector<std::complex<double>> phasors(m_nChannels);
+	std::vector<double> pdAmplitudes(m_nChannels);
+	std::complex<double> sum;
+	for (int c = 0; c < m_nChannels; c++)
+	{
+		const double dA =
+			(dInv[1][0] * m_pdX[c] + dInv[1][1] * m_pdXC[c] + dInv[1][2] * m_pdXS[c]) / dDet;
+		const double dB =
+			(dInv[2][0] * m_pdX[c] + dInv[2][1] * m_pdXC[c] + dInv[2][2] * m_pdXS[c]) / dDet;
+		phasors[c] = std::complex<double>(dA, -dB);
+		pdAmplitudes[c] = std::abs(phasors[c]) * m_dUnitScale;
+		if (pdAmplitudes[c] > 0) sum += phasors[c] / std::abs(phasors[c]);
+	}
+
+	// phases relative to the mean direction, then centered on their median so that a few
+	// deviating channels don't shift the reference
+	std::vector<double> pdPhases(m_nChannels);
+	for (int c = 0; c < m_nChannels; c++)
+		pdPhases[c] = std::remainder(std::arg(phasors[c]) - std::arg(sum), 2 * dPi) * 180 / dPi;
+	const double dMedianAmplitude = Median(pdAmplitudes);
+	const double dMedianPhase = Median(pdPhases);
+	for (int c = 0; c < m_nChannels; c++)
+	{
+		ChannelCalibration& channel = result[c];
+		channel.dAmplitude = pdAmplitudes[c];
+		channel.dGain = dMedianAmplitude > 0 ? pdAmplitudes[c] / dMedianAmplitude : 0;
+		channel.dPhase = pdPhases[c] - dMedianPhase;
+		channel.bWithinTolerance = channel.dAmplitude > 0 &&
+								   std::fabs(channel.dGain - 1) <= dGainTolerance &&
+								   std::fabs(channel.dPhase) <= dPhaseTolerance;
+	}
+	return result;
+}
+
+void ApplyChannelScales(float* __restrict pfData, int nSamples, int nStride, int nChannels,
+	const float* __restrict pfScales)
+{
+	for (int s = 0; s < nSamples; s++, pfData += nStride)
+		for (int c = 0; c < nChannels; c++) pfData[c] *= pfScales[c];
+}
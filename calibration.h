@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+struct ChannelCalibration
+{
+	double dAmplitude; // of the fundamental of the calibration signal, in microvolts
+	double dGain;	   // amplitude relative to the median channel
+	double dPhase;	   // degrees relative to the median channel
+	bool bWithinTolerance;
+};
+
+// Gain and phase of every channel against the amplifier's calibration generator, estimated
+// while the data streams in: each channel is fit with offset + cos + sin at the generator
+// frequency by accumulating the least-squares normal equations, so nothing but a few sums
+// per channel is kept, however long the run. Gains and phases are reported relative to
+// the other channels because all of them see the same generator signal.
+class CalibrationAnalyzer
+{
+private:
+	int m_nChannels;
+	int m_nStride; // words per multiplexed sample (channels + trigger)
+	double m_dSamplingRate;
+	double m_dFrequency;
+	double m_dUnitScale;
+	int64_t m_nSettle; // samples skipped while the amplifier settles
+	int64_t m_nSamples;
+
+	// sums over the reference functions, shared by all channels
+	double m_dN, m_dC, m_dS, m_dCC, m_dCS, m_dSS;
+	// sums over the data: x, x cos, x sin
+	std::vector<double> m_pdX, m_pdXC, m_pdXS;
+
+public:
+	CalibrationAnalyzer(int nChannels, double dSamplingRate, double dFrequency, double dUnitScale,
+		double dSettle = 1.0);
+
+	// pnData: nSamples multiplexed samples of nChannels data words plus one trigger word
+	void Process(const int16_t* pnData, int nSamples);
+	// seconds of data that went into the fit so far
+	double Duration() const { return m_dN / m_dSamplingRate; }
+	// dGainTolerance is relative (0.02 = 2 %), dPhaseTolerance in degrees
+	std::vector<ChannelCalibration> Result(double dGainTolerance, double dPhaseTolerance) const;
+};
+
+// multiplies every channel of nSamples multiplexed samples by its own factor
+void ApplyChannelScales(
+	float* pfData, int nSamples, int nStride, int nChannels, const float* pfScales);
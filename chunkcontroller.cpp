@@ -0,0 +1,90 @@
+#include "chunkcontroller.h"
+#include <algorithm>
+#include <cmath>
+
+// forgetting factor per measurement, ~50 blocks memory
+static const double dForget = 0.98;
+// block length relative to the sustainable one that the controller aims for within the target
+static const double dMargin = 1.5;
+
+ChunkSizeController::ChunkSizeController(double dSamplingRate, int nGranularity,
+	int nInitialBlockLen, int nMaxBlockLen, double dTargetLatency, double dMaxLoad)
+	: m_dSamplingRate(dSamplingRate), m_dTargetLatency(dTargetLatency), m_dMaxLoad(dMaxLoad),
+	  m_nGranularity(nGranularity), m_nMinBlockLen(nGranularity),
+	  m_nMaxBlockLen(nMaxBlockLen - nMaxBlockLen % nGranularity), m_dSw(0), m_dSn(0), m_dSnn(0),
+	  m_dSp(0), m_dSnp(0), m_dOverhead(0), m_dPerSample(0), m_dSinceUpdate(0),
+	  m_nBufferFilling(0), m_bFeasible(true), m_nChanges(0)
+{
+	m_nBlockLen = Round(nInitialBlockLen);
+}
+
+int ChunkSizeController::Round(double dBlockLen) const
+{
+	int nBlockLen = static_cast<int>(std::ceil(dBlockLen / m_nGranularity)) * m_nGranularity;
+	return std::min(std::max(nBlockLen, m_nMinBlockLen), m_nMaxBlockLen);
+}
+
+void ChunkSizeController::AddMeasurement(int nBlockLen, double dProcessingTime)
+{
+	const double dN = nBlockLen;
+	m_dSw = dForget * m_dSw + 1;
+	m_dSn = dForget * m_dSn + dN;
+	m_dSnn = dForget * m_dSnn + dN * dN;
+	m_dSp = dForget * m_dSp + dProcessingTime;
+	m_dSnp = dForget * m_dSnp + dN * dProcessingTime;
+	m_dSinceUpdate += dN / m_dSamplingRate;
+}
+
+void ChunkSizeController::Fit()
+{
+	const double dVar = m_dSw * m_dSnn - m_dSn * m_dSn;
+	if (dVar > 1e-3 * m_dSw * m_dSnn)
+	{
+		m_dPerSample = std::max(0.0, (m_dSw * m_dSnp - m_dSn * m_dSp) / dVar);
+		m_dOverhead = std::max(0.0, (m_dSp - m_dPerSample * m_dSn) / m_dSw);
+	}
+	else
+	{
+		// all measurements at (nearly) the same block length: attribute everything to the
+		// per-block overhead, which errs on the side of larger blocks
+		m_dPerSample = 0;
+		m_dOverhead = m_dSp / m_dSw;
+	}
+}
+
+double ChunkSizeController::EstimatedLatency() const
+{
+	return m_nBlockLen / m_dSamplingRate + m_dOverhead + m_dPerSample * m_nBlockLen;
+}
+
+bool ChunkSizeController::Update()
+{
+	if (m_dSinceUpdate < 0.5 || m_dSw == 0) return false;
+	m_dSinceUpdate = 0;
+	Fit();
+
+	// smallest block for which a + b*N <= load * N / fs
+	const double dHeadroom = m_dMaxLoad / m_dSamplingRate - m_dPerSample;
+	double dSustainable = dHeadroom > 0 ? m_dOverhead / dHeadroom : m_nMaxBlockLen;
+	// largest block for which N / fs + a + b*N <= target
+	double dBudget = (m_dTargetLatency - m_dOverhead) / (1.0 / m_dSamplingRate + m_dPerSample);
+
+	// the driver is falling behind: the fit is too optimistic, back off quickly
+	if (m_nBufferFilling < 0 || m_nBufferFilling > 10)
+		dSustainable = std::max(dSustainable, 2.0 * m_nBlockLen);
+	m_nBufferFilling = 0;
+
+	m_bFeasible = dSustainable <= dBudget;
+	// within the target, keep a margin above the sustainable length for load spikes that the
+	// fit averages out, as much of it as the target leaves; beyond the target, the reader
+	// must keep up regardless
+	double dTarget = m_bFeasible ? std::min(dBudget, dMargin * dSustainable) : dSustainable;
+	// never move by more than a factor of two per decision so the fit sees the new regime
+	dTarget = std::max(dTarget, 0.5 * m_nBlockLen);
+	dTarget = std::min(dTarget, 2.0 * m_nBlockLen);
+	const int nBlockLen = Round(dTarget);
+	if (nBlockLen == m_nBlockLen) return false;
+	m_nBlockLen = nBlockLen;
+	m_nChanges++;
+	return true;
+}
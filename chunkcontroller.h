@@ -0,0 +1,55 @@
+#pragma once
+
+// Picks the number of hardware samples read per block so that the end-to-end latency
+// (block length + processing time) stays within a target while the reader thread stays
+// below a sustainable CPU load. The processing cost is modelled as p(N) = a + b * N
+// (fixed per-block overhead plus per-sample cost) and fitted with exponential forgetting,
+// so the decision follows load changes. If no block length satisfies both, the load wins
+// and Feasible() turns false.
+class ChunkSizeController
+{
+private:
+	double m_dSamplingRate;
+	double m_dTargetLatency; // seconds
+	double m_dMaxLoad;		 // fraction of one core the reader may use
+	int m_nGranularity;		 // block lengths are multiples of this
+	int m_nMinBlockLen;
+	int m_nMaxBlockLen;
+	int m_nBlockLen;
+
+	// weighted sums for the least squares fit of p(N)
+	double m_dSw, m_dSn, m_dSnn, m_dSp, m_dSnp;
+	double m_dOverhead;		// a, seconds per block
+	double m_dPerSample;	// b, seconds per sample
+	double m_dSinceUpdate;	// seconds of data since the last decision
+	long m_nBufferFilling; // last driver buffer filling state, < 0 = overflow
+	bool m_bFeasible;
+	int m_nChanges;
+
+	void Fit();
+	int Round(double dBlockLen) const;
+
+public:
+	ChunkSizeController(double dSamplingRate, int nGranularity, int nInitialBlockLen,
+		int nMaxBlockLen, double dTargetLatency, double dMaxLoad = 0.2);
+
+	// processing time in seconds spent on a block of nBlockLen samples
+	void AddMeasurement(int nBlockLen, double dProcessingTime);
+	// driver buffer filling state in percent as returned by IOCTL_BA_BUFFERFILLING_STATE
+	void SetBufferFilling(long nPercent) { m_nBufferFilling = nPercent; }
+	// re-evaluates the block length about twice a second; returns true if it changed
+	bool Update();
+	// true if the buffer filling state should be queried before the next Update()
+	bool WantsBufferFilling() const { return m_dSinceUpdate >= 0.5; }
+
+	int BlockLen() const { return m_nBlockLen; }
+	int MaxBlockLen() const { return m_nMaxBlockLen; }
+	int Granularity() const { return m_nGranularity; }
+	double TargetLatency() const { return m_dTargetLatency; }
+	double MaxLoad() const { return m_dMaxLoad; }
+	// expected worst case latency of the current block length in seconds
+	double EstimatedLatency() const;
+	// false if the latency target can't be met without overloading the reader
+	bool Feasible() const { return m_bFeasible; }
+	int Changes() const { return m_nChanges; }
+};
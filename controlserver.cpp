@@ -0,0 +1,96 @@
+#include "controlserver.h"
+#include <QJsonDocument>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <stdexcept>
+
+// requests are short; a client that sends this much without a newline is dropped
+static const qint64 max_request_bytes = 1 << 20;
+// how long a running instance with the same name gets to accept a probe connection
+static const int probe_timeout_ms = 500;
+
+ControlServer::ControlServer(const QString &name, Handler handler, QObject *parent)
+	: QObject(parent), handler(std::move(handler)), server(new QLocalServer) {
+	server->moveToThread(&thread);
+	connect(&thread, &QThread::finished, server, &QObject::deleteLater);
+	thread.start();
+	QString error;
+	QMetaObject::invokeMethod(
+		server,
+		[this, name, &error]() {
+			// the socket file of an instance that crashed would block the name, but a running
+			// instance keeps it: its clients would silently end up talking to this one
+			QLocalSocket probe;
+			probe.connectToServer(name);
+			if (probe.waitForConnected(probe_timeout_ms)) {
+				probe.disconnectFromServer();
+				error = "the name is in use by another running instance";
+				return;
+			}
+			QLocalServer::removeServer(name);
+			if (!server->listen(name)) {
+				error = server->errorString();
+				return;
+			}
+			fullName = server->fullServerName();
+			connect(server, &QLocalServer::newConnection, server, [this]() { acceptConnections(); });
+		},
+		Qt::BlockingQueuedConnection);
+	if (!error.isEmpty()) {
+		thread.quit();
+		thread.wait();
+		throw std::runtime_error("Could not open the control endpoint '" + name.toStdString() +
+								 "': " + error.toStdString());
+	}
+}
+
+ControlServer::~ControlServer() {
+	// the server and its connections are deleted on their thread as it finishes
+	thread.quit();
+	thread.wait();
+}
+
+void ControlServer::acceptConnections() {
+	while (QLocalSocket *socket = server->nextPendingConnection()) {
+		const quint64 id = nextId++;
+		connections.insert(id, socket);
+		connect(socket, &QLocalSocket::readyRead, server, [this, id]() { readRequests(id); });
+		connect(socket, &QLocalSocket::disconnected, server, [this, id, socket]() {
+			connections.remove(id);
+			socket->deleteLater();
+		});
+	}
+}
+
+void ControlServer::readRequests(quint64 id) {
+	QLocalSocket *socket = connections.value(id);
+	if (!socket) return;
+	while (socket->canReadLine()) {
+		const QByteArray line = socket->readLine().trimmed();
+		if (line.isEmpty()) continue;
+		QJsonParseError parse_error;
+		const QJsonDocument document = QJsonDocument::fromJson(line, &parse_error);
+		const QJsonObject request = document.object();
+		// malformed requests are answered through the same queue, so replies stay in order
+		QJsonObject invalid;
+		if (parse_error.error != QJsonParseError::NoError)
+			invalid = QJsonObject{{"ok", false}, {"error", parse_error.errorString()}};
+		else if (!document.isObject())
+			invalid = QJsonObject{{"ok", false}, {"error", "A request must be a JSON object."}};
+		QMetaObject::invokeMethod(
+			this,
+			[this, id, request, invalid]() {
+				QJsonObject reply = invalid.isEmpty() ? handler(request) : invalid;
+				if (request.contains("id")) reply["id"] = request["id"];
+				QMetaObject::invokeMethod(
+					server, [this, id, reply]() { sendReply(id, reply); }, Qt::QueuedConnection);
+			},
+			Qt::QueuedConnection);
+	}
+	if (socket->bytesAvailable() > max_request_bytes) socket->abort();
+}
+
+void ControlServer::sendReply(quint64 id, const QJsonObject &reply) {
+	if (QLocalSocket *socket = connections.value(id))
+		socket->write(QJsonDocument(reply).toJson(QJsonDocument::Compact) + '\n');
+}
@@ -0,0 +1,44 @@
+#ifndef CONTROLSERVER_H
+#define CONTROLSERVER_H
+#include <QHash>
+#include <QJsonObject>
+#include <QObject>
+#include <QString>
+#include <QThread>
+#include <functional>
+
+class QLocalServer;
+class QLocalSocket;
+
+// Local control endpoint for experiment scripts: a QLocalServer (a Unix domain socket, or a
+// named pipe on Windows) that reads one JSON object per line and answers each with one JSON
+// object per line. The sockets and the JSON parsing live on the server's own thread; each
+// request is posted to the handler on the thread that owns the ControlServer (the GUI
+// thread), which posts the answer back, so neither thread ever waits for the other and the
+// acquisition thread is not involved at all.
+class ControlServer : public QObject {
+	Q_OBJECT
+public:
+	using Handler = std::function<QJsonObject(const QJsonObject &request)>;
+	// starts listening on name; throws if the endpoint can't be opened or another running
+	// instance listens on it already
+	ControlServer(const QString &name, Handler handler, QObject *parent = nullptr);
+	~ControlServer() override;
+	// platform path of the endpoint, e.g. /tmp/<name> or \\.\pipe\<name>
+	QString fullServerName() const { return fullName; }
+
+private:
+	// server thread only
+	void acceptConnections();
+	void readRequests(quint64 id);
+	void sendReply(quint64 id, const QJsonObject &reply);
+
+	Handler handler;
+	QThread thread;
+	QLocalServer *server;
+	QHash<quint64, QLocalSocket *> connections;
+	quint64 nextId{0};
+	QString fullName;
+};
+
+#endif // CONTROLSERVER_H
@@ -0,0 +1,48 @@
+#include "dcoffsetscheduler.h"
+#include <cmath>
+
+DcOffsetScheduler::DcOffsetScheduler(int nChannels, double dSamplingRate, double dLimit,
+	double dQuietTime, double dIdleTime, double dMaxDelay, double dMinInterval)
+	: m_nStride(nChannels + 1), m_dLimit(dLimit),
+	  m_nQuietTime(static_cast<int64_t>(dQuietTime * dSamplingRate)),
+	  m_nIdleTime(static_cast<int64_t>(dIdleTime * dSamplingRate)),
+	  m_nMaxDelay(static_cast<int64_t>(dMaxDelay * dSamplingRate)),
+	  m_nMinInterval(static_cast<int64_t>(dMinInterval * dSamplingRate)), m_nSamples(0),
+	  m_nLastTrigger(0), m_nDueSince(-1), m_nLastCorrection(-1), m_nPrevTrigger(0),
+	  m_nCorrections(0)
+{
+}
+
+void DcOffsetScheduler::UpdateOffsets(const std::vector<ChannelQuality>& quality)
+{
+	bool bDue = false;
+	for (const auto& q : quality) bDue |= std::fabs(q.fOffset) > m_dLimit;
+	if (!bDue)
+		m_nDueSince = -1;
+	else if (m_nDueSince < 0)
+		m_nDueSince = m_nSamples;
+}
+
+bool DcOffsetScheduler::Process(const int16_t* pnData, int nSamples)
+{
+	// only the trigger word of each sample is looked at
+	const int16_t* pnTrigger = pnData + m_nStride - 1;
+	for (int s = 0; s < nSamples; s++, pnTrigger += m_nStride)
+	{
+		const uint16_t nTrigger = static_cast<uint16_t>(*pnTrigger);
+		if (nTrigger != m_nPrevTrigger) m_nLastTrigger = m_nSamples + s;
+		m_nPrevTrigger = nTrigger;
+	}
+	m_nSamples += nSamples;
+
+	if (m_nDueSince < 0) return false;
+	if (m_nLastCorrection >= 0 && m_nSamples - m_nLastCorrection < m_nMinInterval) return false;
+	const int64_t nSinceTrigger = m_nSamples - m_nLastTrigger;
+	const bool bAfterTrigger = m_nLastTrigger >= m_nDueSince && nSinceTrigger >= m_nQuietTime;
+	if (!bAfterTrigger && nSinceTrigger < m_nIdleTime && m_nSamples - m_nDueSince < m_nMaxDelay)
+		return false;
+	m_nDueSince = -1;
+	m_nLastCorrection = m_nSamples;
+	m_nCorrections++;
+	return true;
+}
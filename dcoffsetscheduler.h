@@ -0,0 +1,42 @@
+#pragma once
+#include "qualitymonitor.h"
+#include <cstdint>
+#include <vector>
+
+// Decides when to run the amplifier's DC offset correction during a DC-coupled recording.
+// The running offsets come from the quality monitor's windows, so no extra pass over the data
+// is needed. Once a channel drifts past the limit, a correction is due, but it's held back
+// until just after the next trigger, which is when the following one is furthest away, so the
+// gap it causes doesn't hide an event. Without any trigger activity it's done right away, and
+// if the triggers never settle, it goes ahead after a maximum delay rather than letting the
+// channel clip.
+class DcOffsetScheduler
+{
+private:
+	int m_nStride; // words per multiplexed sample (channels + trigger)
+	double m_dLimit; // microvolts
+	int64_t m_nQuietTime, m_nIdleTime, m_nMaxDelay, m_nMinInterval; // samples
+	int64_t m_nSamples;
+	int64_t m_nLastTrigger;	   // sample of the last change on the trigger channel
+	int64_t m_nDueSince;	   // sample at which the correction became due, -1 if it isn't
+	int64_t m_nLastCorrection; // sample of the last correction, -1 if there was none
+	uint16_t m_nPrevTrigger;
+	int m_nCorrections;
+
+public:
+	// dLimit: offset in microvolts that makes a correction due; dQuietTime: seconds after a
+	// trigger change before correcting; dIdleTime: seconds without trigger changes after which
+	// there's no event to wait for; dMaxDelay: seconds after which the correction is done
+	// regardless of triggers; dMinInterval: seconds between corrections, so the windows that
+	// still contain the old offsets don't cause another one
+	DcOffsetScheduler(int nChannels, double dSamplingRate, double dLimit, double dQuietTime = 0.1,
+		double dIdleTime = 2.0, double dMaxDelay = 5.0, double dMinInterval = 10.0);
+
+	// offsets of the last quality window
+	void UpdateOffsets(const std::vector<ChannelQuality>& quality);
+	// pnData: nSamples multiplexed samples of the channels plus one trigger word; returns true
+	// if the correction should be done now
+	bool Process(const int16_t* pnData, int nSamples);
+	bool Due() const { return m_nDueSince >= 0; }
+	int Corrections() const { return m_nCorrections; }
+};
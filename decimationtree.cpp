@@ -0,0 +1,174 @@
+#include "decimationtree.h"
+#include "downsampler.h"
+#include <algorithm>
+#include <stdexcept>
+
+DecimationStage::DecimationStage(int nFactor, int nChannels, int nFilteredChannels)
+	: m_nFactor(nFactor), m_nChannels(nChannels), m_nFilteredChannels(nFilteredChannels),
+	  m_nPhase(0), m_pdZ(2 * nFilteredChannels, 0.0)
+{
+	DesignDecimationFilter(nFactor, m_pdB, m_pdA);
+}
+
+int DecimationStage::Process(
+	const double* pdIn, int nInStride, int nSamples, double* pdOut, int nOutStride)
+{
+	const int nFirst = m_nFactor - 1 - m_nPhase;
+	int nOut = 0;
+	for (int c = 0; c < m_nChannels; c++)
+	{
+		const double* pdX = pdIn + c * nInStride;
+		double* pdY = pdOut + c * nOutStride;
+		nOut = 0;
+		if (c < m_nFilteredChannels)
+		{
+			// direct form II transposed, state kept in registers for the whole block
+			double dZ0 = m_pdZ[2 * c], dZ1 = m_pdZ[2 * c + 1];
+			int nNext = nFirst;
+			for (int i = 0; i < nSamples; i++)
+			{
+				const double dXi = pdX[i];
+				const double dYi = m_pdB[0] * dXi + dZ0;
+				dZ0 = m_pdB[1] * dXi + dZ1 - m_pdA[1] * dYi;
+				dZ1 = m_pdB[2] * dXi - m_pdA[2] * dYi;
+				if (i == nNext)
+				{
+					pdY[nOut++] = dYi;
+					nNext += m_nFactor;
+				}
+			}
+			m_pdZ[2 * c] = dZ0;
+			m_pdZ[2 * c + 1] = dZ1;
+		}
+		else
+			for (int i = nFirst; i < nSamples; i += m_nFactor) pdY[nOut++] = pdX[i];
+	}
+	m_nPhase = (m_nPhase + nSamples) % m_nFactor;
+	return nOut;
+}
+
+DecimationTree::DecimationTree(int nChannels, int nFilteredChannels,
+	const std::vector<int>& pnFactors, int nMaxBlockLen)
+	: m_nChannels(nChannels), m_nSamplesTotal(0)
+{
+	Build(nFilteredChannels, pnFactors, nMaxBlockLen);
+}
+
+DecimationTree::DecimationTree(int nChannels, int nFilteredChannels, int nInputRate,
+	const std::vector<int>& pnRates, int nMaxBlockLen)
+	: m_nChannels(nChannels), m_nSamplesTotal(0)
+{
+	std::vector<int> pnFactors;
+	for (int nRate : pnRates)
+	{
+		if (nRate < 1 || nRate > nInputRate)
+			throw std::invalid_argument("Output rates must be between 1 Hz and the input rate.");
+		pnFactors.push_back(PreDecimationFactor(nInputRate, nRate));
+	}
+	Build(nFilteredChannels, pnFactors, nMaxBlockLen);
+
+	for (size_t o = 0; o < pnRates.size(); o++)
+	{
+		const int nNodeRate = nInputRate / pnFactors[o];
+		if (nNodeRate == pnRates[o]) continue;
+		Sink& output = m_outputs[o];
+		output.pResampler.reset(new RationalResampler(pnRates[o], nNodeRate, nChannels,
+			nFilteredChannels, m_nodes[output.nNode].nCapacity));
+		output.nCapacity = output.pResampler->MaxOutputLen(m_nodes[output.nNode].nCapacity);
+		output.pdData.resize(nChannels * output.nCapacity, 0.0);
+	}
+}
+
+int DecimationTree::PreDecimationFactor(int nInputRate, int nRate)
+{
+	if (nInputRate % nRate == 0) return nInputRate / nRate;
+	int nFactor = 1;
+	for (int n = 2; nInputRate / n >= 2 * nRate; n++)
+		if (nInputRate % n == 0) nFactor = n;
+	return nFactor;
+}
+
+void DecimationTree::Build(
+	int nFilteredChannels, const std::vector<int>& pnFactors, int nMaxBlockLen)
+{
+	const int nChannels = m_nChannels;
+	Node root;
+	root.nFactor = 1;
+	root.nParent = -1;
+	root.nCapacity = nMaxBlockLen;
+	root.nCount = 0;
+	root.pdData.resize(nChannels * nMaxBlockLen, 0.0);
+	m_nodes.push_back(root);
+
+	// create the nodes in ascending factor order so that every parent exists already
+	std::vector<int> pnSorted(pnFactors);
+	std::sort(pnSorted.begin(), pnSorted.end());
+	pnSorted.erase(std::unique(pnSorted.begin(), pnSorted.end()), pnSorted.end());
+	for (int nFactor : pnSorted)
+	{
+		if (nFactor < 1) throw std::invalid_argument("Decimation factors must be positive.");
+		if (nFactor == 1) continue;
+		int nParent = 0;
+		for (int n = 1; n < static_cast<int>(m_nodes.size()); n++)
+			if (nFactor % m_nodes[n].nFactor == 0) nParent = n;
+		Node node;
+		node.nFactor = nFactor;
+		node.nParent = nParent;
+		node.nCapacity = nMaxBlockLen / nFactor + 1;
+		node.nCount = 0;
+		node.pStage.reset(
+			new DecimationStage(nFactor / m_nodes[nParent].nFactor, nChannels, nFilteredChannels));
+		node.pdData.resize(nChannels * node.nCapacity, 0.0);
+		m_nodes.push_back(std::move(node));
+	}
+
+	for (int nFactor : pnFactors)
+		for (int n = 0; n < static_cast<int>(m_nodes.size()); n++)
+			if (m_nodes[n].nFactor == nFactor)
+			{
+				Sink output;
+				output.nNode = n;
+				output.nCapacity = m_nodes[n].nCapacity;
+				output.nCount = 0;
+				m_outputs.push_back(std::move(output));
+				break;
+			}
+}
+
+void DecimationTree::Process(int nSamples)
+{
+	m_nodes[0].nCount = nSamples;
+	for (size_t n = 1; n < m_nodes.size(); n++)
+	{
+		Node& node = m_nodes[n];
+		const Node& parent = m_nodes[node.nParent];
+		node.nCount = node.pStage->Process(parent.pdData.data(), parent.nCapacity, parent.nCount,
+			node.pdData.data(), node.nCapacity);
+	}
+	for (Sink& output : m_outputs)
+	{
+		const Node& node = m_nodes[output.nNode];
+		output.nCount = output.pResampler
+							? output.pResampler->Process(node.pdData.data(), node.nCapacity,
+								  node.nCount, output.pdData.data(), output.nCapacity)
+							: node.nCount;
+	}
+	m_nSamplesTotal += nSamples;
+}
+
+double DecimationTree::OutputLag(int nOutput) const
+{
+	const Sink& output = m_outputs[nOutput];
+	const int nFactor = m_nodes[output.nNode].nFactor;
+	double dLag = static_cast<double>(m_nSamplesTotal % nFactor);
+	if (output.pResampler) dLag += output.pResampler->Lag() * nFactor;
+	return dLag;
+}
+
+int DecimationTree::StageCount() const
+{
+	int nStages = static_cast<int>(m_nodes.size()) - 1;
+	for (const Sink& output : m_outputs)
+		if (output.pResampler) nStages++;
+	return nStages;
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class RationalResampler;
+
+// One filter + decimate step for a bank of channels. The decimation phase is carried
+// over between blocks, so the input block length does not need to be a multiple of the
+// factor. Channels [0, nFilteredChannels) are lowpass filtered, the remaining ones
+// (e.g. the trigger channel) are only picked.
+class DecimationStage
+{
+private:
+	int m_nFactor;
+	int m_nChannels;
+	int m_nFilteredChannels;
+	int m_nPhase;
+	double m_pdB[3];
+	double m_pdA[3];
+	std::vector<double> m_pdZ; // 2 state variables per filtered channel
+
+public:
+	DecimationStage(int nFactor, int nChannels, int nFilteredChannels);
+
+	// pdIn / pdOut are channel-major with the given strides; returns the number of
+	// samples written per channel
+	int Process(const double* pdIn, int nInStride, int nSamples, double* pdOut, int nOutStride);
+};
+
+// A set of decimators that share intermediate results: every requested output factor is
+// computed from the largest already requested factor that divides it, e.g. 5000 Hz ->
+// 1000 Hz -> 250 Hz instead of filtering the 5 kHz signal twice. Rates that are not an
+// integer divisor of the input rate are decimated by an integer factor first (at least
+// twice the output rate is left) and then resampled by the remaining rational factor,
+// which keeps the polyphase filter and thus the cost per output sample bounded.
+class DecimationTree
+{
+private:
+	struct Node
+	{
+		int nFactor;	 // total factor relative to the input
+		int nParent;	 // -1 for the root
+		int nCapacity; // samples per channel in pdData
+		int nCount;	 // samples per channel produced by the last block
+		std::shared_ptr<DecimationStage> pStage; // null for the root
+		std::vector<double> pdData;
+	};
+	struct Sink
+	{
+		int nNode;
+		std::shared_ptr<RationalResampler> pResampler; // null for integer factors
+		int nCapacity;
+		int nCount;
+		std::vector<double> pdData; // only used with a resampler
+	};
+	std::vector<Node> m_nodes;
+	std::vector<Sink> m_outputs;
+	int m_nChannels;
+	int64_t m_nSamplesTotal;
+
+	void Build(int nFilteredChannels, const std::vector<int>& pnFactors, int nMaxBlockLen);
+
+public:
+	// pnFactors: one entry per output, may contain duplicates and 1 (pass-through)
+	DecimationTree(int nChannels, int nFilteredChannels, const std::vector<int>& pnFactors,
+		int nMaxBlockLen);
+	// pnRates: one output rate in Hz per output, at most nInputRate
+	DecimationTree(int nChannels, int nFilteredChannels, int nInputRate,
+		const std::vector<int>& pnRates, int nMaxBlockLen);
+
+	// the integer factor applied before the rational resampler (the whole factor if the
+	// rate divides the input rate)
+	static int PreDecimationFactor(int nInputRate, int nRate);
+
+	// channel-major input buffer, fill up to nMaxBlockLen samples per channel before Process()
+	double* Input(int nChannel) { return &m_nodes[0].pdData[nChannel * m_nodes[0].nCapacity]; }
+	void Process(int nSamples);
+
+	int OutputCount(int nOutput) const { return m_outputs[nOutput].nCount; }
+	const double* Output(int nOutput, int nChannel) const
+	{
+		const Sink& output = m_outputs[nOutput];
+		if (output.pResampler) return &output.pdData[nChannel * output.nCapacity];
+		const Node& node = m_nodes[output.nNode];
+		return &node.pdData[nChannel * node.nCapacity];
+	}
+	// samples per channel the output can hold, i.e. its OutputCount() for the longest block
+	int OutputCapacity(int nOutput) const { return m_outputs[nOutput].nCapacity; }
+	// number of input samples between the last output sample and the end of the last block
+	double OutputLag(int nOutput) const;
+	// number of decimation and resampling stages that are actually computed (for diagnostics)
+	int StageCount() const;
+};
@@ -1 +1,137 @@
 #include "downsampler.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+void DesignDecimationFilter(int nFactor, double* pdB, double* pdA)
+{
+	// bilinear transform of an analog 2nd order Butterworth prototype, cutoff at the
+	// Nyquist frequency of the decimated signal (i.e. butter(2, 1/nFactor))
+	const double dPi = 3.14159265358979323846;
+	const double dK = std::tan(dPi / (2.0 * nFactor));
+	const double dNorm = 1.0 / (1.0 + std::sqrt(2.0) * dK + dK * dK);
+	pdB[0] = dK * dK * dNorm;
+	pdB[1] = 2.0 * pdB[0];
+	pdB[2] = pdB[0];
+	pdA[0] = 1.0;
+	pdA[1] = 2.0 * (dK * dK - 1.0) * dNorm;
+	pdA[2] = (1.0 - std::sqrt(2.0) * dK + dK * dK) * dNorm;
+}
+
+// zeroth order modified Bessel function of the first kind, for the Kaiser window
+static double BesselI0(double dX)
+{
+	double dSum = 1.0, dTerm = 1.0;
+	for (int k = 1; k < 50 && dTerm > 1e-12 * dSum; k++)
+	{
+		dTerm *= (dX / (2.0 * k)) * (dX / (2.0 * k));
+		dSum += dTerm;
+	}
+	return dSum;
+}
+
+static int GreatestCommonDivisor(int nA, int nB)
+{
+	while (nB)
+	{
+		const int nT = nA % nB;
+		nA = nB;
+		nB = nT;
+	}
+	return nA;
+}
+
+RationalResampler::RationalResampler(int nUp, int nDown, int nChannels, int nFilteredChannels,
+	int nMaxBlockLen, int nZeroCrossings)
+	: m_nChannels(nChannels), m_nFilteredChannels(nFilteredChannels), m_nInputTotal(0),
+	  m_nNextOutput(0)
+{
+	if (nUp < 1 || nDown < 1) throw std::invalid_argument("Resampling factors must be positive.");
+	const int nGcd = GreatestCommonDivisor(nUp, nDown);
+	m_nUp = nUp / nGcd;
+	m_nDown = nDown / nGcd;
+
+	// the prototype runs at nUp times the input rate and cuts off below the lower of the
+	// two Nyquist frequencies; its length grows with the decimation ratio so that the
+	// transition band stays the same relative to the output rate
+	const double dPi = 3.14159265358979323846;
+	const double dBeta = 6.0; // about 60 dB stopband attenuation
+	const double dRatio = std::max(1.0, static_cast<double>(m_nDown) / m_nUp);
+	m_nTaps = static_cast<int>(std::ceil(2 * nZeroCrossings * dRatio));
+	const int nLen = m_nTaps * m_nUp;
+	const double dCutoff = 0.8 * 0.5 / (m_nUp * dRatio); // cycles per prototype sample
+	const double dCenter = (nLen - 1) / 2.0;
+	m_dGroupDelay = dCenter / m_nUp;
+	m_nDelay = static_cast<int>(std::lround(m_dGroupDelay));
+
+	std::vector<double> pdH(nLen);
+	for (int i = 0; i < nLen; i++)
+	{
+		const double dT = i - dCenter;
+		const double dSinc = (dT == 0.0) ? 1.0 : std::sin(2 * dPi * dCutoff * dT) /
+													 (2 * dPi * dCutoff * dT);
+		const double dW = dT / (dCenter + 1.0);
+		pdH[i] = dSinc * BesselI0(dBeta * std::sqrt(1.0 - dW * dW)) / BesselI0(dBeta);
+	}
+	// phase p holds h[p], h[p + up], h[p + 2 up], ... in reverse order; each phase is
+	// normalized to unit DC gain so large electrode offsets don't turn into ripple
+	m_pdTable.resize(nLen);
+	for (int p = 0; p < m_nUp; p++)
+	{
+		double dSum = 0.0;
+		for (int j = 0; j < m_nTaps; j++) dSum += pdH[p + j * m_nUp];
+		for (int j = 0; j < m_nTaps; j++)
+			m_pdTable[p * m_nTaps + m_nTaps - 1 - j] = pdH[p + j * m_nUp] / dSum;
+	}
+
+	m_nStride = m_nTaps - 1 + nMaxBlockLen;
+	m_pdBuffer.resize(static_cast<size_t>(m_nChannels) * m_nStride, 0.0);
+}
+
+int RationalResampler::Process(
+	const double* pdIn, int nInStride, int nSamples, double* pdOut, int nOutStride)
+{
+	const int nHistory = m_nTaps - 1;
+	// the first block pre-fills the history with its first sample to avoid a step response
+	// (and a spurious marker on the trigger channel)
+	if (m_nInputTotal == 0 && nSamples > 0)
+		for (int c = 0; c < m_nChannels; c++)
+			std::fill_n(&m_pdBuffer[c * m_nStride], nHistory, pdIn[c * nInStride]);
+	for (int c = 0; c < m_nChannels; c++)
+		std::copy_n(pdIn + c * nInStride, nSamples, &m_pdBuffer[c * m_nStride + nHistory]);
+
+	// output k sits at input position k * down / up and uses the inputs up to that position
+	const int64_t nEnd = m_nInputTotal + nSamples;
+	int nOut = 0;
+	for (; (m_nNextOutput * m_nDown) / m_nUp < nEnd; m_nNextOutput++, nOut++)
+	{
+		const int64_t nPos = m_nNextOutput * m_nDown;
+		const int nStart = static_cast<int>(nPos / m_nUp - m_nInputTotal);
+		const double* pdCoeffs = &m_pdTable[(nPos % m_nUp) * m_nTaps];
+		for (int c = 0; c < m_nFilteredChannels; c++)
+		{
+			const double* pdX = &m_pdBuffer[c * m_nStride + nStart];
+			double dAcc = 0.0;
+			for (int j = 0; j < m_nTaps; j++) dAcc += pdCoeffs[j] * pdX[j];
+			pdOut[c * nOutStride + nOut] = dAcc;
+		}
+		for (int c = m_nFilteredChannels; c < m_nChannels; c++)
+			pdOut[c * nOutStride + nOut] = m_pdBuffer[c * m_nStride + nStart + nHistory - m_nDelay];
+	}
+
+	// keep the last m_nTaps - 1 samples for the next block
+	for (int c = 0; c < m_nChannels; c++)
+	{
+		double* pdChannel = &m_pdBuffer[c * m_nStride];
+		std::copy(pdChannel + nSamples, pdChannel + nSamples + nHistory, pdChannel);
+	}
+	m_nInputTotal = nEnd;
+	return nOut;
+}
+
+double RationalResampler::Lag() const
+{
+	if (m_nNextOutput == 0) return 0.0;
+	const double dLast = static_cast<double>((m_nNextOutput - 1) * m_nDown) / m_nUp;
+	return static_cast<double>(m_nInputTotal - 1) - dLast + m_dGroupDelay;
+}
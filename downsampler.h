@@ -1,4 +1,5 @@
 #pragma once
+#include <cstdint>
 #include <memory>
 #include <vector>
 
@@ -105,8 +106,55 @@ const double pdBCoeffs20[] = { 0.005542717210281,   0.011085434420561,   0.00554
 const double pdACoeffs20[] = { 1.000000000000000, -1.778631777824585,   0.800802646665708};
 const double pdBCoeffs25[] = { 0.003621681514929,   0.007243363029857,   0.003621681514929};
 const double pdACoeffs25[] = { 1.000000000000000, -1.822694925196308,   0.837181651256023};
-const double pdBCoeffs50[] = { 0.020083365564211,   0.040166731128423,   0.020083365564211};
-const double pdACoeffs50[] = { 1.000000000000000, - 1.561018075800718,   0.641351538057563};
+const double pdBCoeffs50[] = { 0.000944691843840,   0.001889383687680,   0.000944691843840};
+const double pdACoeffs50[] = { 1.000000000000000, -1.911197067426073,   0.914975834801434};
+
+// designs the anti-aliasing filter for an arbitrary integer decimation factor
+// (3 b and 3 a coefficients; identical to the tables above)
+void DesignDecimationFilter(int nFactor, double* pdB, double* pdA);
+
+// Polyphase resampler by a rational factor nUp / nDown for a bank of channels. The
+// Kaiser windowed sinc prototype is split into nUp phase tables once, so every output
+// sample costs one dot product of TapsPerPhase() coefficients per channel. Channels
+// [0, nFilteredChannels) are interpolated, the remaining ones (e.g. the trigger channel)
+// are picked at the same delay, so they stay aligned with the filtered channels.
+class RationalResampler
+{
+private:
+	int m_nUp;
+	int m_nDown;
+	int m_nChannels;
+	int m_nFilteredChannels;
+	int m_nTaps; // per phase
+	int m_nDelay; // group delay in input samples, rounded, for the picked channels
+	double m_dGroupDelay; // in input samples
+	int m_nStride; // samples per channel in m_pdBuffer
+	int64_t m_nInputTotal;
+	int64_t m_nNextOutput;
+	std::vector<double> m_pdTable;  // m_nUp x m_nTaps, reversed so they run along the input
+	std::vector<double> m_pdBuffer; // channel-major, m_nTaps - 1 samples history + block
+
+public:
+	// nZeroCrossings sets the filter length in output samples on each side of the center
+	RationalResampler(int nUp, int nDown, int nChannels, int nFilteredChannels,
+		int nMaxBlockLen, int nZeroCrossings = 10);
+
+	// pdIn / pdOut are channel-major with the given strides; returns the number of
+	// samples written per channel (at most MaxOutputLen(nSamples))
+	int Process(const double* pdIn, int nInStride, int nSamples, double* pdOut, int nOutStride);
+
+	int MaxOutputLen(int nInputLen) const
+	{
+		return static_cast<int>((static_cast<int64_t>(nInputLen) * m_nUp) / m_nDown) + 1;
+	}
+	// number of input samples between the last output sample (including the group delay)
+	// and the end of the last block
+	double Lag() const;
+	int Up() const { return m_nUp; }
+	int Down() const { return m_nDown; }
+	int TapsPerPhase() const { return m_nTaps; }
+};
+
 template<class T>
 class Downsampler
 {
@@ -0,0 +1,70 @@
+#include "epochextractor.h"
+#include <algorithm>
+
+template <typename T>
+EpochExtractor<T>::EpochExtractor(int nChannels, int nPreSamples, int nPostSamples,
+	int nMaxChunk, const std::vector<uint16_t>& codes, int nMaxPending)
+	: m_nChannels(nChannels), m_nPre(nPreSamples), m_nPost(nPostSamples), m_codes(codes),
+	  m_nWritten(0), m_nMaxPending(nMaxPending), m_nEpochs(0), m_nDropped(0)
+{
+	// an epoch is taken after the Append that completes it, by which time up to a chunk
+	// more has been written behind its last sample
+	const std::size_t nCapacity = nPreSamples + nPostSamples + nMaxChunk;
+	m_ring.resize(nCapacity * nChannels);
+	m_ringTimestamps.resize(nCapacity);
+	m_pending.reserve(nMaxPending);
+	m_epoch.resize(static_cast<std::size_t>(EpochSamples()) * (nChannels + 1));
+	m_epochTimestamps.resize(EpochSamples());
+	std::sort(m_codes.begin(), m_codes.end());
+}
+
+template <typename T> bool EpochExtractor<T>::IsEpochCode(uint16_t nCode) const
+{
+	return std::binary_search(m_codes.begin(), m_codes.end(), nCode);
+}
+
+template <typename T> void EpochExtractor<T>::Trigger(int nSample, uint16_t nCode)
+{
+	const uint64_t nPosition = m_nWritten + nSample;
+	if (nPosition < static_cast<uint64_t>(m_nPre) || m_pending.size() == m_nMaxPending)
+		m_nDropped++;
+	else
+		m_pending.push_back(PendingEpoch{nPosition, nCode});
+}
+
+template <typename T>
+void EpochExtractor<T>::Append(
+	const T* pData, int nStride, int nSamples, double dLastTimestamp, double dRate)
+{
+	const std::size_t nCapacity = m_ringTimestamps.size();
+	for (int s = 0; s < nSamples; s++, pData += nStride)
+	{
+		const std::size_t nSlot = (m_nWritten + s) % nCapacity;
+		std::copy(pData, pData + m_nChannels, m_ring.begin() + nSlot * m_nChannels);
+		m_ringTimestamps[nSlot] = dLastTimestamp - (nSamples - 1 - s) / dRate;
+	}
+	m_nWritten += nSamples;
+}
+
+template <typename T> bool EpochExtractor<T>::NextEpoch()
+{
+	if (m_pending.empty() || m_pending.front().nSample + m_nPost > m_nWritten) return false;
+	const PendingEpoch epoch = m_pending.front();
+	m_pending.erase(m_pending.begin());
+	const std::size_t nCapacity = m_ringTimestamps.size();
+	const T code = static_cast<T>(epoch.nCode);
+	auto epoch_it = m_epoch.begin();
+	for (int s = 0; s < EpochSamples(); s++)
+	{
+		const std::size_t nSlot = (epoch.nSample - m_nPre + s) % nCapacity;
+		const auto ring_it = m_ring.cbegin() + nSlot * m_nChannels;
+		epoch_it = std::copy(ring_it, ring_it + m_nChannels, epoch_it);
+		*epoch_it++ = code;
+		m_epochTimestamps[s] = m_ringTimestamps[nSlot];
+	}
+	m_nEpochs++;
+	return true;
+}
+
+template class EpochExtractor<int16_t>;
+template class EpochExtractor<float>;
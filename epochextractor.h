@@ -0,0 +1,54 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+// Cuts fixed windows around selected trigger codes out of an output stream, so a consumer
+// (e.g. a P300 classifier) gets each epoch as one chunk instead of buffering the continuous
+// stream and decoding the triggers itself. The recent samples are kept in a ring that is
+// allocated once and long enough for the window plus one chunk; when the post-trigger part of
+// an epoch has arrived, it's copied out of the ring together with its time stamps.
+// Instantiated for int16_t (raw streams) and float.
+template <typename T> class EpochExtractor
+{
+private:
+	struct PendingEpoch
+	{
+		uint64_t nSample; // ring position of the trigger sample
+		uint16_t nCode;
+	};
+
+	int m_nChannels, m_nPre, m_nPost;
+	std::vector<uint16_t> m_codes;
+	std::vector<T> m_ring; // multiplexed
+	std::vector<double> m_ringTimestamps;
+	uint64_t m_nWritten; // samples appended so far
+	std::vector<PendingEpoch> m_pending; // in trigger order, waiting for their post samples
+	std::size_t m_nMaxPending;
+	std::vector<T> m_epoch; // the channels plus the code of the last epoch taken
+	std::vector<double> m_epochTimestamps;
+	uint64_t m_nEpochs, m_nDropped;
+
+public:
+	// nPreSamples, nPostSamples: window before and from the trigger sample on; nMaxChunk: most
+	// samples per Append; codes: trigger codes that start an epoch; nMaxPending: epochs that may
+	// wait for their post samples at once, more triggers are dropped
+	EpochExtractor(int nChannels, int nPreSamples, int nPostSamples, int nMaxChunk,
+		const std::vector<uint16_t>& codes, int nMaxPending = 64);
+
+	bool IsEpochCode(uint16_t nCode) const;
+	// sample nSample of the chunk that is appended next changed the trigger to nCode
+	void Trigger(int nSample, uint16_t nCode);
+	// pData: nSamples multiplexed samples of nStride values, of which the first nChannels are
+	// kept; dLastTimestamp is that of the last sample
+	void Append(const T* pData, int nStride, int nSamples, double dLastTimestamp, double dRate);
+	// copies the next complete epoch into Epoch() and EpochTimestamps(); false if there's none
+	bool NextEpoch();
+
+	int EpochSamples() const { return m_nPre + m_nPost; }
+	// EpochSamples() multiplexed samples of the channels plus the trigger code as last channel
+	const T* Epoch() const { return m_epoch.data(); }
+	const double* EpochTimestamps() const { return m_epochTimestamps.data(); }
+	uint64_t Epochs() const { return m_nEpochs; }
+	// triggers too close to the start of the acquisition, or with too many epochs pending
+	uint64_t Dropped() const { return m_nDropped; }
+};
@@ -5,12 +5,16 @@
 int main(int argc, char *argv[]) {
 	// determine the startup config file...
 	const char *config_file = "BrainAmpSeries.cfg";
-	for (int k = 1; k < argc; k++)
+	// ...and the name of the control endpoint for scripts, if any
+	const char *control_name = nullptr;
+	for (int k = 1; k < argc - 1; k++) {
 		if (std::string(argv[k]) == "-c" || std::string(argv[k]) == "--config")
 			config_file = argv[k + 1];
+		if (std::string(argv[k]) == "--control") control_name = argv[k + 1];
+	}
 
 	QApplication a(argc, argv);
-	MainWindow w(nullptr, config_file);
+	MainWindow w(nullptr, config_file, control_name);
 	w.show();
 	return a.exec();
 }
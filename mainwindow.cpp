@@ -1,66 +1,125 @@
 #include "mainwindow.h"
-#include "downsampler.h"
+#include "artifactsubspace.h"
+#include "auxdecimator.h"
+#include "calibration.h"
+#include "chunkcontroller.h"
+#include "controlserver.h"
+#include "dcoffsetscheduler.h"
+#include "decimationtree.h"
+#include "epochextractor.h"
+#include "markerinlet.h"
+#include "previewenvelope.h"
+#include "qualitymonitor.h"
+#include "sharedmemoryring.h"
+#include "threadscheduling.h"
 #include "ui_mainwindow.h"
 #include <QCloseEvent>
+#include <QDateTime>
 #include <QDebug>
+#include <QDir>
 #include <QFileDialog>
+#include <QFileInfo>
+#include <QIntValidator>
+#include <QJsonArray>
 #include <QMessageBox>
 #include <QSettings>
 #include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QTimer>
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <cstdlib>
 #include <iostream>
+#include <limits>
 #include <lsl_cpp.h>
 #include <sstream>
 
 #ifdef WIN32
 #include <winioctl.h>
 #else
-// dummy declarations to test compilation / static analysis on Linux/OS X
-static HANDLE INVALID_HANDLE_VALUE = nullptr;
-enum Dummy {
-	FILE_DEVICE_UNKNOWN,
-	NORMAL_PRIORITY_CLASS,
-	METHOD_BUFFERED,
-	FILE_WRITE_DATA,
-	FILE_READ_DATA,
-	GENERIC_READ,
-	GENERIC_WRITE,
-	FILE_ATTRIBUTE_NORMAL,
-	FILE_FLAG_WRITE_THROUGH,
-	OPEN_EXISTING,
-	HIGH_PRIORITY_CLASS
-};
-inline int GetCurrentProcess() { return 0; }
-inline int SetPriorityClass(int, int) { return 0; }
-inline int CTL_CODE(int, int, int, int) { return 0; }
-inline void CloseHandle(HANDLE) {}
-inline bool DeviceIoControl(HANDLE, int, void *, int, void *, int, void *, void *) { return true; }
-inline HANDLE CreateFileA(const char *, int, int, void *, int, int, void *) {
-	return static_cast<void *>(&INVALID_HANDLE_VALUE);
-}
-inline int32_t GetLastError() { return 0; }
-inline bool ReadFile(HANDLE, int16_t *, int, ulong *, void *) { return false; }
-using DWORD = unsigned long;
-using USHORT = uint16_t;
-using ULONG = unsigned long;
-using CHAR = signed char;
-using UCHAR = unsigned char;
+// no BrainAmp driver outside of Windows, use a simulated amplifier instead
+#include "simulateddevice.h"
 #endif
 
 #include "BrainAmpIoCtl.h"
 
+// hardware rate first, followed by the presets offered in the sampling rate box
 const int sampling_rates[] = {5000, 2500, 1000, 500, 250, 200, 100};
 double sampling_rate = (double)sampling_rates[0];
-const int downsampling_factors[] = {1, 2, 5, 10, 20, 25, 50};
-int downsampling_factor = downsampling_factors[0];
+// 0 if the sampling rate is not an integer divisor of the hardware rate and gets resampled
+int downsampling_factor = 1;
+// calibration runs: generator frequency in Hz, length of the fit in seconds (after the
+// analyzer's settling time), driver block length, and the limits for a usable channel
+const double calibration_frequency = 5.0;
+const double calibration_seconds = 5.0;
+const long calibration_block = 50;
+const double calibration_gain_tolerance = 0.02;
+const double calibration_phase_tolerance = 2.0;
+// automatic DC offset correction: the part of the int16 range a channel's offset may take up
+// before it is corrected, and the data after a correction that's flagged as a gap
+const double dc_offset_limit = 0.8;
+const double dc_correction_gap = 0.2;
+const char *dc_correction_marker = "DCOffsetCorrection";
+// prefix of the markers that announce a new block length in auto chunk size mode
+const char *chunk_size_marker = "ChunkSize";
+// external markers held by the reader until all outputs have passed their time stamp
+const std::size_t max_external_markers = 256;
+// external markers stamped further ahead of the data than this are dropped: they would hold
+// back every marker behind them until the samples catch up, which a wrong clock offset or a
+// garbled sender may never let happen
+const double max_external_marker_lead = 5.0;
+// data a shared memory reader may fall behind before it loses chunks, at the shortest block
+const double shared_memory_seconds = 2.0;
+// how often the reader asks the driver for data it discarded on overflows
+const double missing_check_seconds = 0.5;
+// microvolts per bit for each ReaderConfig::Resolution
+const float unit_scales[] = {0.1f, 0.5f, 10.f, 152.6f};
 static const char *error_messages[] = {"No error.", "Loss lock.", "Low power.",
 	"Can't establish communication at start.", "Synchronisation error"};
 
 
+// block length granularity in auto chunk size mode: at least 1 ms and a whole number of
+// samples at the selected sampling rate
+static unsigned int auto_block_granularity() {
+	// resampled outputs carry their phase across blocks, so only the 1 ms floor applies
+	if (!downsampling_factor) return sampling_rates[0] / 1000;
+	return downsampling_factor * std::max(1, static_cast<int>(sampling_rate) / 1000);
+}
+
+// hardware samples that make up chunk_size samples at the selected sampling rate
+static unsigned int block_samples(unsigned int chunk_size) {
+	return static_cast<unsigned int>(
+		std::max(1L, std::lround(chunk_size * sampling_rates[0] / sampling_rate)));
+}
+
+// float samples are converted to microvolts per channel in one vectorized pass; raw samples
+// are sent as they are and carry the factors in the stream meta-data
+static void scale_channels(
+	float *data, int samples, unsigned int stride, const std::vector<float> &scales) {
+	ApplyChannelScales(data, samples, static_cast<int>(stride), static_cast<int>(scales.size()),
+		scales.data());
+}
+static void scale_channels(int16_t *, int, unsigned int, const std::vector<float> &) {}
+
+// data channel value of the samples right after a DC offset correction
+static float gap_value(float) { return std::numeric_limits<float>::quiet_NaN(); }
+static int16_t gap_value(int16_t) { return std::numeric_limits<int16_t>::min(); }
+
+// overwrites the data channels of the samples stamped within [gap_start, gap_end)
+template <typename T>
+static void flag_gap(T *data, int samples, unsigned int stride, unsigned int channels,
+	double last_ts, double rate, double gap_start, double gap_end) {
+	for (int s = 0; s < samples; s++, data += stride) {
+		const double ts = last_ts + (s + 1 - samples) / rate;
+		if (ts >= gap_start && ts < gap_end) std::fill_n(data, channels, gap_value(T()));
+	}
+}
+
 #define LSLVERSIONSTREAM(version) (version / 100) << "." << (version % 100)
 #define APPVERSIONSTREAM(version) version.Major << "." << version.Minor << "." << version.Bugfix
 
-MainWindow::MainWindow(QWidget *parent, const char *config_file)
+MainWindow::MainWindow(QWidget *parent, const char *config_file, const char *control_name)
 	: QMainWindow(parent), ui(new Ui::MainWindow) {
 	ui->setupUi(this);
 
@@ -78,16 +137,35 @@ MainWindow::MainWindow(QWidget *parent, const char *config_file)
 		save_config(QFileDialog::getSaveFileName(
 			this, "Save Configuration File", "", "Configuration Files (*.cfg)"));
 	});
-	connect(ui->cbSamplingRate, SIGNAL(currentIndexChanged(int)), this, SLOT(setSamplingRate()));
+	connect(ui->cbSamplingRate, SIGNAL(currentTextChanged(QString)), this, SLOT(setSamplingRate()));
 	connect(ui->actionQuit, &QAction::triggered, this, &MainWindow::close);
 	connect(ui->linkButton, &QPushButton::clicked, this, &MainWindow::toggleRecording);
+	connect(ui->calibrateButton, &QPushButton::clicked, this, &MainWindow::calibrate);
 	QObject::connect(ui->actionVersions, SIGNAL(triggered()), this, SLOT(VersionsDialog()));
 	QObject::connect(
 		ui->channelCount, SIGNAL(valueChanged(int)), this, SLOT(UpdateChannelLabelsGUI(int)));
 	for (int i = 0; i < 7; i++)
 		ui->cbSamplingRate->addItem(QString::fromStdString(std::to_string(sampling_rates[i])));
+	ui->cbSamplingRate->setValidator(new QIntValidator(1, sampling_rates[0], this));
+	// the reader thread only fills the quality snapshot, the GUI picks it up at its own pace
+	auto *qualityTimer = new QTimer(this);
+	connect(qualityTimer, &QTimer::timeout, [this]() {
+		std::vector<ChannelQuality> quality;
+		if (qualityMonitor && qualityMonitor->Snapshot(quality))
+			ui->qualityGrid->setQuality(quality);
+	});
+	qualityTimer->start(500);
 	QString cfgfilepath = find_config_file(config_file);
 	load_config(cfgfilepath);
+	if (control_name) {
+		try {
+			controlServer.reset(new ControlServer(control_name,
+				[this](const QJsonObject &request) { return control(request); }));
+			ui->statusBar->showMessage("Control endpoint: " + controlServer->fullServerName());
+		} catch (std::exception &e) {
+			QMessageBox::warning(this, "Control endpoint", e.what(), QMessageBox::Ok);
+		}
+	}
 }
 
 
@@ -125,22 +203,29 @@ void MainWindow::VersionsDialog() {
 	QMessageBox::information(this, "Versions", ss.str().c_str(), QMessageBox::Ok);
 }
 void MainWindow::setSamplingRate() {
-	sampling_rate = sampling_rates[ui->cbSamplingRate->currentIndex()];
-	downsampling_factor = downsampling_factors[ui->cbSamplingRate->currentIndex()];
+	sampling_rate = ui->cbSamplingRate->currentText().toInt();
+	if (sampling_rate > 0 && sampling_rate <= sampling_rates[0])
+		downsampling_factor = sampling_rates[0] % static_cast<int>(sampling_rate)
+								  ? 0
+								  : sampling_rates[0] / static_cast<int>(sampling_rate);
 }
 
-int getSamplingRateIndex(int nSamplingRate) {
-	switch (nSamplingRate) {
-	case 5000: return 0;
-	case 2500: return 1;
-	case 1000: return 2;
-	case 500: return 3;
-	case 250: return 4;
-	case 200: return 5;
-	case 100: return 6;
-	default: break;
+// parses a list like "1-20, 33, 25" (a montage, trigger codes) into numbers in list order
+static std::vector<int> parse_ranges(const QString &list, const char *what, int min, int max) {
+	std::vector<int> numbers;
+	for (auto &entry : list.split(',')) {
+		if (entry.trimmed().isEmpty()) continue;
+		QStringList range = entry.trimmed().split('-');
+		bool ok_first = false, ok_last = range.size() == 1;
+		int first = range[0].trimmed().toInt(&ok_first);
+		int last = range.size() == 2 ? range[1].trimmed().toInt(&ok_last) : first;
+		if (!ok_first || !ok_last || range.size() > 2 || first < min || last < first ||
+			last > max)
+			throw std::runtime_error(std::string("Invalid ") + what + " entry '" +
+									 entry.trimmed().toStdString() + "'.");
+		for (int n = first; n <= last; n++) numbers.push_back(n);
 	}
-	return 0;
+	return numbers;
 }
 
 void MainWindow::load_config(const QString &filename) {
@@ -148,17 +233,33 @@ void MainWindow::load_config(const QString &filename) {
 
 	ui->deviceNumber->setValue(pt.value("settings/devicenumber", 1).toInt());
 	ui->channelCount->setValue(pt.value("settings/channelcount", 32).toInt());
+	ui->montage->setText(pt.value("channels/montage").toStringList().join(", "));
 	ui->impedanceMode->setCurrentIndex(pt.value("settings/impedancemode", 0).toInt());
-	ui->cbSamplingRate->setCurrentIndex(
-		getSamplingRateIndex(pt.value("settings/samplingrate", 500).toInt()));
+	ui->cbSamplingRate->setCurrentText(pt.value("settings/samplingrate", 500).toString());
 	setSamplingRate();
 	ui->resolution->setCurrentIndex(pt.value("settings/resolution", 0).toInt());
 	ui->dcCoupling->setCurrentIndex(pt.value("settings/dccoupling", 0).toInt());
+	ui->autoDCCorrection->setChecked(pt.value("settings/autodccorrection", false).toBool());
+	ui->additionalRates->setText(pt.value("settings/additionalrates").toStringList().join(", "));
 	ui->chunkSize->setValue(pt.value("settings/chunksize", 32).toInt());
+	ui->latencyBudget->setValue(pt.value("settings/latencybudget", 0).toInt());
 	ui->usePolyBox->setChecked(pt.value("settings/usepolybox", false).toBool());
+	ui->auxRate->setValue(pt.value("settings/auxrate", 0).toInt());
+	ui->sendQualityStream->setChecked(pt.value("settings/sendqualitystream", false).toBool());
+	ui->asrCutoff->setValue(pt.value("settings/asrcutoff", 0).toInt());
+	ui->asrCalibration->setValue(pt.value("settings/asrcalibration", 60).toInt());
+	ui->applyCalibration->setChecked(pt.value("settings/applycalibration", false).toBool());
+	ui->calibrationWaveform->setCurrentIndex(pt.value("settings/calibrationwaveform", 0).toInt());
+	ui->realtimeScheduling->setChecked(pt.value("settings/realtimescheduling", false).toBool());
+	ui->schedCpu->setValue(pt.value("settings/readercpu", -1).toInt());
 	ui->sendRawStream->setChecked(pt.value("settings/sendrawstream", false).toBool());
+	ui->sharedMemory->setChecked(pt.value("settings/sharedmemory", false).toBool());
 	ui->unsampledMarkers->setChecked(pt.value("settings/unsampledmarkers", false).toBool());
 	ui->sampledMarkersEEG->setChecked(pt.value("settings/sampledmarkersEEG", false).toBool());
+	ui->markerInlet->setText(pt.value("settings/markerinlet").toString());
+	ui->epochTriggers->setText(pt.value("settings/epochtriggers").toStringList().join(", "));
+	ui->epochPre->setValue(pt.value("settings/epochpre", 200).toInt());
+	ui->epochPost->setValue(pt.value("settings/epochpost", 800).toInt());
 	ui->channelLabels->setPlainText(pt.value("channels/labels").toStringList().join('\n'));
 }
 
@@ -171,233 +272,764 @@ void MainWindow::save_config(const QString &filename) {
 	pt.setValue("devicenumber", ui->deviceNumber->value());
 	pt.setValue("channelcount", ui->channelCount->value());
 	pt.setValue("samplingrate", ui->cbSamplingRate->currentText());
+	pt.setValue("additionalrates",
+		ui->additionalRates->text().remove(' ').split(',', QString::SkipEmptyParts));
 	pt.setValue("impedancemode", ui->impedanceMode->currentIndex());
 	pt.setValue("resolution", ui->resolution->currentIndex());
 	pt.setValue("dccoupling", ui->dcCoupling->currentIndex());
+	pt.setValue("autodccorrection", ui->autoDCCorrection->isChecked());
 	pt.setValue("chunksize", ui->chunkSize->value());
+	pt.setValue("latencybudget", ui->latencyBudget->value());
 	pt.setValue("usepolybox", ui->usePolyBox->isChecked());
+	pt.setValue("auxrate", ui->auxRate->value());
+	pt.setValue("sendqualitystream", ui->sendQualityStream->isChecked());
+	pt.setValue("asrcutoff", ui->asrCutoff->value());
+	pt.setValue("asrcalibration", ui->asrCalibration->value());
+	pt.setValue("applycalibration", ui->applyCalibration->isChecked());
+	pt.setValue("calibrationwaveform", ui->calibrationWaveform->currentIndex());
+	pt.setValue("realtimescheduling", ui->realtimeScheduling->isChecked());
+	pt.setValue("readercpu", ui->schedCpu->value());
 	pt.setValue("sendrawstream", ui->sendRawStream->isChecked());
+	pt.setValue("sharedmemory", ui->sharedMemory->isChecked());
 	pt.setValue("unsampledmarkers", ui->unsampledMarkers->isChecked());
 	pt.setValue("sampledmarkersEEG", ui->sampledMarkersEEG->isChecked());
+	pt.setValue("markerinlet", ui->markerInlet->text());
+	pt.setValue("epochtriggers",
+		ui->epochTriggers->text().remove(' ').split(',', QString::SkipEmptyParts));
+	pt.setValue("epochpre", ui->epochPre->value());
+	pt.setValue("epochpost", ui->epochPost->value());
 	pt.endGroup();
 
 	pt.beginGroup("channels");
 	pt.setValue("labels", ui->channelLabels->toPlainText().split('\n'));
+	pt.setValue("montage", ui->montage->text().remove(' ').split(',', QString::SkipEmptyParts));
 	pt.endGroup();
 }
 
 void MainWindow::closeEvent(QCloseEvent *ev) {
-	if (reader) {
+	if (reader || calibrator) {
 		QMessageBox::warning(this, "Recording still running", "Can't quit while recording");
 		ev->ignore();
 	}
 }
 
+// file with the calibration table of one amplifier, shared by all configurations
+static QString calibration_file(unsigned int serial_number) {
+	return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) +
+		   QDir::separator() + QStringLiteral("BrainAmpSeries-%1.cal").arg(serial_number);
+}
+
+// table section of the amplifier input behind output channel c
+static QString calibration_key(const ReaderConfig &conf, unsigned int c) {
+	const int channel = conf.montage[c] - (conf.usePolyBox ? 8 : 0);
+	return channel > 0 ? QStringLiteral("channel%1").arg(channel)
+					   : QStringLiteral("polybox%1").arg(channel + 8);
+}
+
+// gain correction for each channel in conf; channels that were never calibrated or were out
+// of tolerance keep a factor of 1
+static std::vector<float> load_calibration(const ReaderConfig &conf) {
+	const QString filename = calibration_file(conf.serialNumber);
+	if (!QFileInfo::exists(filename))
+		throw std::runtime_error("There is no calibration table for amplifier " +
+								 std::to_string(conf.serialNumber) +
+								 ", please run a calibration first.");
+	QSettings table(filename, QSettings::IniFormat);
+	std::vector<float> gains(conf.channelCount, 1.f);
+	for (unsigned int c = 0; c < conf.channelCount; c++) {
+		const QString key = calibration_key(conf, c);
+		if (table.value(key + "/withintolerance", false).toBool())
+			gains[c] = static_cast<float>(1.0 / table.value(key + "/gain", 1.0).toDouble());
+	}
+	return gains;
+}
+
+// merges the result of a calibration run into the amplifier's table
+static QString save_calibration(const ReaderConfig &conf, const QString &waveform,
+	const std::vector<ChannelCalibration> &result) {
+	const QString filename = calibration_file(conf.serialNumber);
+	QDir().mkpath(QFileInfo(filename).path());
+	QSettings table(filename, QSettings::IniFormat);
+	table.beginGroup("calibration");
+	table.setValue("serialnumber", conf.serialNumber);
+	table.setValue("date", QDateTime::currentDateTime().toString(Qt::ISODate));
+	table.setValue("waveform", waveform);
+	table.setValue("frequency", calibration_frequency);
+	table.endGroup();
+	for (unsigned int c = 0; c < conf.channelCount; c++) {
+		table.beginGroup(calibration_key(conf, c));
+		table.setValue("amplitude", result[c].dAmplitude);
+		table.setValue("gain", result[c].dGain);
+		table.setValue("phase", result[c].dPhase);
+		table.setValue("withintolerance", result[c].bWithinTolerance);
+		table.endGroup();
+	}
+	return filename;
+}
+
+// reads the device settings from the GUI and checks them
+ReaderConfig MainWindow::gui_config() {
+	setSamplingRate();
+	if (sampling_rate <= 0 || sampling_rate > sampling_rates[0])
+		throw std::runtime_error("The sampling rate must be an integer between 1 and " +
+								 std::to_string(sampling_rates[0]) + " Hz.");
+	ReaderConfig conf;
+	conf.deviceNumber = ui->deviceNumber->value();
+	conf.channelCount = static_cast<unsigned int>(ui->channelCount->value());
+	conf.lowImpedanceMode = ui->impedanceMode->currentIndex() == 1;
+	conf.resolution = static_cast<ReaderConfig::Resolution>(ui->resolution->currentIndex());
+	conf.dcCoupling = static_cast<unsigned char>(ui->dcCoupling->currentIndex());
+	conf.autoDCCorrection = conf.dcCoupling && ui->autoDCCorrection->isChecked();
+	conf.chunkSize = ui->chunkSize->value();
+	conf.targetLatencyMs = ui->latencyBudget->value();
+	conf.usePolyBox = ui->usePolyBox->checkState() == Qt::Checked;
+	conf.auxRate = static_cast<unsigned int>(ui->auxRate->value());
+	conf.realtimeScheduling = ui->realtimeScheduling->isChecked();
+	conf.sendQualityStream = ui->sendQualityStream->isChecked();
+	conf.sharedMemory = ui->sharedMemory->isChecked();
+	conf.readerCpu = ui->schedCpu->value();
+	conf.asrCutoff = static_cast<unsigned int>(ui->asrCutoff->value());
+	conf.asrCalibrationSeconds = static_cast<unsigned int>(ui->asrCalibration->value());
+	conf.markerInlet = ui->markerInlet->text().trimmed().toStdString();
+	// code 0 is the idle state of the trigger input, not a trigger
+	for (int code : parse_ranges(ui->epochTriggers->text(), "trigger code", 1, 0xffff))
+		conf.epochTriggers.push_back(static_cast<uint16_t>(code));
+	conf.epochPreMs = static_cast<unsigned int>(ui->epochPre->value());
+	conf.epochPostMs = static_cast<unsigned int>(ui->epochPost->value());
+	for (auto &label : ui->channelLabels->toPlainText().split('\n'))
+		conf.channelLabels.push_back(label.toStdString());
+	if (conf.channelLabels.size() != conf.channelCount)
+		throw std::runtime_error("The number of channels labels does not match the channel "
+								 "count device setting.");
+	// amplifier channel of each output channel; PolyBox channels are numbered first
+	const int polyBoxChannels = conf.usePolyBox ? 8 : 0;
+	conf.montage =
+		parse_ranges(ui->montage->text(), "montage", 1, std::numeric_limits<int>::max());
+	if (conf.montage.empty())
+		for (unsigned int c = 1; c <= conf.channelCount; c++) conf.montage.push_back(c);
+	if (conf.montage.size() != conf.channelCount)
+		throw std::runtime_error("The montage selects " + std::to_string(conf.montage.size()) +
+								 " channels, which does not match the channel count device "
+								 "setting.");
+	for (int channel : conf.montage)
+		if (channel > 256 + polyBoxChannels)
+			throw std::runtime_error("The montage refers to channel " + std::to_string(channel) +
+									 ", which the amplifier doesn't have.");
+	for (auto &rate : ui->additionalRates->text().split(',')) {
+		if (rate.trimmed().isEmpty()) continue;
+		int r = rate.trimmed().toInt();
+		if (r <= 0 || r >= sampling_rates[0])
+			throw std::runtime_error("Additional sampling rates must be integers below " +
+									 std::to_string(sampling_rates[0]) + " Hz.");
+		if (r == sampling_rate)
+			throw std::runtime_error("Additional sampling rates must differ from the "
+									 "sampling rate setting.");
+		conf.additionalRates.push_back(r);
+	}
+	if (conf.auxRate) {
+		if (sampling_rates[0] % static_cast<int>(conf.auxRate))
+			throw std::runtime_error("The AUX sampling rate must divide " +
+									 std::to_string(sampling_rates[0]) + " Hz.");
+		if (std::all_of(conf.montage.begin(), conf.montage.end(),
+				[polyBoxChannels](int channel) { return channel <= polyBoxChannels; }))
+			throw std::runtime_error("With an AUX sampling rate, the montage needs at least one "
+									 "EEG channel besides the PolyBox channels.");
+	}
+	return conf;
+}
+
+// opens the amplifier and applies the settings without starting the acquisition; the
+// driver delivers blocks of block_len samples
+void MainWindow::open_device(ReaderConfig &conf, long block_len) {
+	DWORD bytes_returned;
+	// try to open the device
+	std::string deviceName = R"(\\.\BrainAmpUSB)" + std::to_string(conf.deviceNumber);
+	m_hDevice = CreateFileA(deviceName.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_WRITE_THROUGH, nullptr);
+	if (m_hDevice == INVALID_HANDLE_VALUE) {
+		m_hDevice = nullptr;
+		throw std::runtime_error(
+			"Could not open USB device. Please make sure that the device is plugged in, "
+			"turned on, and that the driver is installed correctly.");
+	}
+
+	// get serial number
+	ULONG serialNumber = 0;
+	if (!DeviceIoControl(m_hDevice, IOCTL_BA_GET_SERIALNUMBER, nullptr, 0, &serialNumber,
+			sizeof(serialNumber), &bytes_returned, nullptr))
+		qWarning() << "Could not get device serial number.";
+	conf.serialNumber = serialNumber;
+
+	// set up device parameters
+	BA_SETUP setup = {0};
+	setup.nChannels = conf.channelCount;
+	// the driver's lookup table does the channel selection, so unused channels are
+	// never transferred, filtered or sent
+	const int polyBoxChannels = conf.usePolyBox ? 8 : 0;
+	for (unsigned int c = 0; c < conf.channelCount; c++)
+		setup.nChannelList[c] = static_cast<CHAR>(conf.montage[c] - 1 - polyBoxChannels);
+	setup.nPoints = block_len;
+	setup.nHoldValue = 0;
+	for (unsigned int c = 0; c < conf.channelCount; c++) {
+		setup.nResolution[c] = conf.resolution;
+		setup.nDCCoupling[c] = conf.dcCoupling;
+	}
+	setup.nLowImpedance = conf.lowImpedanceMode;
+
+	m_bPullUpHiBits = true;
+	m_bPullUpLowBits = false;
+	m_nPullDir = (m_bPullUpLowBits ? 0xff : 0) | (m_bPullUpHiBits ? 0xff00 : 0);
+	if (!DeviceIoControl(m_hDevice, IOCTL_BA_DIGITALINPUT_PULL_UP, &m_nPullDir,
+			sizeof(m_nPullDir), nullptr, 0, &bytes_returned, nullptr))
+		throw std::runtime_error("Could not apply pull up/down parameter.");
+
+	if (!DeviceIoControl(m_hDevice, IOCTL_BA_SETUP, &setup, sizeof(setup), nullptr, 0,
+			&bytes_returned, nullptr))
+		throw std::runtime_error("Could not apply device setup parameters.");
+}
+
+// closes the amplifier after opening or starting it failed and returns the driver's reason
+std::string MainWindow::close_failed_device() {
+	DWORD bytes_returned;
+	// try to decode the error message
+	const char *msg = "Could not open USB device.";
+	if (m_hDevice != nullptr) {
+		long error_code = 0;
+		if (DeviceIoControl(m_hDevice, IOCTL_BA_ERROR_STATE, nullptr, 0, &error_code,
+				sizeof(error_code), &bytes_returned, nullptr) &&
+			bytes_returned)
+			msg = ((error_code & 0xFFFF) >= 0 && (error_code & 0xFFFF) <= 4)
+					  ? error_messages[error_code & 0xFFFF]
+					  : "Unknown error (your driver version might not yet be supported).";
+		else
+			msg = "Could not retrieve error message because the device is closed";
+		CloseHandle(m_hDevice);
+		m_hDevice = nullptr;
+	}
+	return msg;
+}
+
+// shows why opening or starting the amplifier failed and closes it again
+void MainWindow::report_device_error(const QString &context, const std::exception &e) {
+	const std::string msg = close_failed_device();
+	QMessageBox::critical(this, "Error",
+		context + e.what() + " (driver message: " + msg.c_str() + ")", QMessageBox::Ok);
+}
+
 // start/stop the BrainAmpSeries connection
 void MainWindow::toggleRecording() {
-	DWORD bytes_returned;
 	if (reader) {
-		// === perform unlink action ===
 		try {
-			shutdown = true;
-			reader->join();
-			reader.reset();
-			SetPriorityClass(GetCurrentProcess(), NORMAL_PRIORITY_CLASS);
-			if (m_hDevice != nullptr) {
-				DeviceIoControl(
-					m_hDevice, IOCTL_BA_STOP, nullptr, 0, nullptr, 0, &bytes_returned, nullptr);
-				CloseHandle(m_hDevice);
-				m_hDevice = nullptr;
-			}
+			unlink();
 		} catch (std::exception &e) {
 			QMessageBox::critical(this, "Error",
 				QString("Could not stop the background processing: ") + e.what(), QMessageBox::Ok);
-			return;
 		}
-
-		// indicate that we are now successfully unlinked
-		ui->linkButton->setText("Link");
-		ui->deviceSettingsGroup->setEnabled(true);
-		ui->triggerSettingsGroup->setEnabled(true);
-		ui->channelLabelsGroup->setEnabled(true);
 	} else {
-		// === perform link action ===
-
 		try {
-			// get the UI parameters...
-			setSamplingRate();
-			ReaderConfig conf;
-			conf.deviceNumber = ui->deviceNumber->value();
-			conf.channelCount = static_cast<unsigned int>(ui->channelCount->value());
-			conf.lowImpedanceMode = ui->impedanceMode->currentIndex() == 1;
-			conf.resolution = static_cast<ReaderConfig::Resolution>(ui->resolution->currentIndex());
-			conf.dcCoupling = static_cast<unsigned char>(ui->dcCoupling->currentIndex());
-			conf.chunkSize = ui->chunkSize->value();
-			conf.usePolyBox = ui->usePolyBox->checkState() == Qt::Checked;
-			bool sendRawStream = ui->sendRawStream->isChecked();
-
-			m_bUnsampledMarkers = ui->unsampledMarkers->checkState() == Qt::Checked;
-
-			m_bSampledMarkersEEG = ui->sampledMarkersEEG->checkState() == Qt::Checked;
-
-			for (auto &label : ui->channelLabels->toPlainText().split('\n'))
-				conf.channelLabels.push_back(label.toStdString());
-			if (conf.channelLabels.size() != conf.channelCount)
-				throw std::runtime_error("The number of channels labels does not match the channel "
-										 "count device setting.");
-
-			// try to open the device
-			std::string deviceName = R"(\\.\BrainAmpUSB)" + std::to_string(conf.deviceNumber);
-			m_hDevice = CreateFileA(deviceName.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr,
-				OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_WRITE_THROUGH, nullptr);
-			if (m_hDevice == INVALID_HANDLE_VALUE)
+			link();
+		} catch (std::exception &e) {
+			QMessageBox::critical(this, "Error",
+				QString("Could not initialize the BrainAmpSeries interface: ") + e.what(),
+				QMessageBox::Ok);
+		}
+	}
+}
+
+void MainWindow::link() {
+	DWORD bytes_returned;
+	if (calibrator) throw std::runtime_error("A calibration is running.");
+	try {
+		ReaderConfig conf = gui_config();
+		bool sendRawStream = ui->sendRawStream->isChecked();
+
+		m_bUnsampledMarkers = ui->unsampledMarkers->checkState() == Qt::Checked;
+
+		m_bSampledMarkersEEG = ui->sampledMarkersEEG->checkState() == Qt::Checked;
+
+		// in auto mode the driver delivers small blocks and the reader reads as many at once
+		// as the chunk size controller asks for
+		open_device(conf, conf.targetLatencyMs ? auto_block_granularity()
+											   : block_samples(conf.chunkSize));
+		if (ui->applyCalibration->isChecked()) conf.channelGains = load_calibration(conf);
+
+		// start recording
+		long acquire_eeg = 1;
+		if (!DeviceIoControl(m_hDevice, IOCTL_BA_START, &acquire_eeg, sizeof(acquire_eeg),
+				nullptr, 0, &bytes_returned, nullptr))
+			throw std::runtime_error("Could not start recording.");
+
+		// start reader thread
+		qualityMonitor = std::make_shared<SignalQualityMonitor>(
+			conf.channelCount, sampling_rates[0], unit_scales[conf.resolution]);
+		ui->qualityGrid->setChannelLabels(conf.channelLabels);
+		previewEnvelope = std::make_shared<PreviewEnvelope>(
+			conf.channelCount, sampling_rates[0], unit_scales[conf.resolution]);
+		ui->signalPreview->setSource(previewEnvelope, conf.channelLabels);
+		shutdown = false;
+		counters.reset();
+		auto function_handle =
+			sendRawStream ? &MainWindow::read_thread<int16_t> : &MainWindow::read_thread<float>;
+		reader.reset(new std::thread(function_handle, this, conf));
+	} catch (std::exception &e) {
+		const std::string msg = close_failed_device();
+		throw std::runtime_error(std::string(e.what()) + " (driver message: " + msg + ")");
+	}
+
+	// done, all successful
+	ui->linkButton->setText("Unlink");
+	ui->calibrateButton->setEnabled(false);
+	ui->deviceSettingsGroup->setEnabled(false);
+	ui->triggerSettingsGroup->setEnabled(false);
+	ui->channelLabelsGroup->setEnabled(false);
+}
+
+void MainWindow::unlink() {
+	DWORD bytes_returned;
+	shutdown = true;
+	reader->join();
+	reader.reset();
+	qualityMonitor.reset();
+	ui->qualityGrid->clearQuality();
+	previewEnvelope.reset();
+	ui->signalPreview->setSource(nullptr, {});
+	if (m_hDevice != nullptr) {
+		DeviceIoControl(m_hDevice, IOCTL_BA_STOP, nullptr, 0, nullptr, 0, &bytes_returned, nullptr);
+		CloseHandle(m_hDevice);
+		m_hDevice = nullptr;
+	}
+
+	// indicate that we are now successfully unlinked
+	ui->linkButton->setText("Link");
+	ui->calibrateButton->setEnabled(true);
+	ui->deviceSettingsGroup->setEnabled(true);
+	ui->triggerSettingsGroup->setEnabled(true);
+	ui->channelLabelsGroup->setEnabled(true);
+}
+
+// runs the amplifier's calibration generator and measures every channel against it
+void MainWindow::calibrate() {
+	if (reader || calibrator) return;
+	DWORD bytes_returned;
+	try {
+		ReaderConfig conf = gui_config();
+		open_device(conf, calibration_block);
+		BA_CALIBRATION_SETTINGS settings;
+		settings.nWaveForm = ui->calibrationWaveform->currentIndex() == 0 ? 2 : 3;
+		settings.nFrequency = static_cast<ULONG>(calibration_frequency * 1000);
+		if (!DeviceIoControl(m_hDevice, IOCTL_BA_CALIBRATION_SETTINGS, &settings,
+				sizeof(settings), nullptr, 0, &bytes_returned, nullptr))
+			throw std::runtime_error("Could not apply the calibration settings.");
+		long acquire_calibration = 2;
+		if (!DeviceIoControl(m_hDevice, IOCTL_BA_START, &acquire_calibration,
+				sizeof(acquire_calibration), nullptr, 0, &bytes_returned, nullptr))
+			throw std::runtime_error("Could not start the calibration.");
+		shutdown = false;
+		calibrator.reset(new std::thread(&MainWindow::calibration_thread, this, conf));
+	} catch (std::exception &e) {
+		report_device_error("Could not start the calibration: ", e);
+		return;
+	}
+	ui->linkButton->setEnabled(false);
+	ui->calibrateButton->setEnabled(false);
+	ui->deviceSettingsGroup->setEnabled(false);
+	ui->channelLabelsGroup->setEnabled(false);
+	ui->statusBar->showMessage("Calibrating...");
+}
+
+// background thread of a calibration run; hands the result over to the GUI thread
+void MainWindow::calibration_thread(const ReaderConfig conf) {
+	std::vector<ChannelCalibration> result;
+	std::string error;
+	try {
+		CalibrationAnalyzer analyzer(conf.channelCount, sampling_rates[0], calibration_frequency,
+			unit_scales[conf.resolution]);
+		std::vector<int16_t> buffer(calibration_block * (conf.channelCount + 1));
+		const DWORD block_bytes = static_cast<DWORD>(buffer.size() * sizeof(int16_t));
+		// the settling time plus a generous margin
+		const auto deadline = std::chrono::steady_clock::now() +
+							  std::chrono::duration<double>(calibration_seconds + 5);
+		while (!shutdown && analyzer.Duration() < calibration_seconds) {
+			DWORD bytes_read = 0;
+			if (!ReadFile(m_hDevice, buffer.data(), block_bytes, &bytes_read, nullptr))
 				throw std::runtime_error(
-					"Could not open USB device. Please make sure that the device is plugged in, "
-					"turned on, and that the driver is installed correctly.");
-
-			// get serial number
-			ULONG serialNumber = 0;
-			if (!DeviceIoControl(m_hDevice, IOCTL_BA_GET_SERIALNUMBER, nullptr, 0, &serialNumber,
-					sizeof(serialNumber), &bytes_returned, nullptr))
-				qWarning() << "Could not get device serial number.";
-
-			// set up device parameters
-			BA_SETUP setup = {0};
-			setup.nChannels = conf.channelCount;
-			for (unsigned char c = 0; c < conf.channelCount; c++)
-				setup.nChannelList[c] = c + (conf.usePolyBox ? -8 : 0);
-			setup.nPoints = conf.chunkSize * downsampling_factor;
-			setup.nHoldValue = 0;
-			for (UCHAR c = 0; c < conf.channelCount; c++) setup.nResolution[c] = conf.resolution;
-			for (UCHAR c = 0; c < conf.channelCount; c++) setup.nDCCoupling[c] = conf.dcCoupling;
-			setup.nLowImpedance = conf.lowImpedanceMode;
-
-			m_bPullUpHiBits = true;
-			m_bPullUpLowBits = false;
-			m_nPullDir = (m_bPullUpLowBits ? 0xff : 0) | (m_bPullUpHiBits ? 0xff00 : 0);
-			if (!DeviceIoControl(m_hDevice, IOCTL_BA_DIGITALINPUT_PULL_UP, &m_nPullDir,
-					sizeof(m_nPullDir), nullptr, 0, &bytes_returned, nullptr))
-				throw std::runtime_error("Could not apply pull up/down parameter.");
-
-			if (!DeviceIoControl(m_hDevice, IOCTL_BA_SETUP, &setup, sizeof(setup), nullptr, 0,
-					&bytes_returned, nullptr))
-				throw std::runtime_error("Could not apply device setup parameters.");
-
-			// start recording
-			long acquire_eeg = 1;
-			if (!DeviceIoControl(m_hDevice, IOCTL_BA_START, &acquire_eeg, sizeof(acquire_eeg),
-					nullptr, 0, &bytes_returned, nullptr))
-				throw std::runtime_error("Could not start recording.");
-
-			// start reader thread
-			shutdown = false;
-			auto function_handle =
-				sendRawStream ? &MainWindow::read_thread<int16_t> : &MainWindow::read_thread<float>;
-			reader.reset(new std::thread(function_handle, this, conf));
+					"Could not read data, error code " + std::to_string(GetLastError()));
+			if (bytes_read == block_bytes)
+				analyzer.Process(buffer.data(), calibration_block);
+			else if (std::chrono::steady_clock::now() > deadline)
+				throw std::runtime_error("The amplifier stopped delivering data.");
+			else
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
 		}
+		result = analyzer.Result(calibration_gain_tolerance, calibration_phase_tolerance);
+	} catch (std::exception &e) { error = e.what(); }
+	QMetaObject::invokeMethod(
+		this, [this, conf, result, error]() { finishCalibration(conf, result, error); },
+		Qt::QueuedConnection);
+}
 
-		catch (std::exception &e) {
-			// try to decode the error message
-			const char *msg = "Could not open USB device.";
-			if (m_hDevice != nullptr) {
-				long error_code = 0;
-				if (DeviceIoControl(m_hDevice, IOCTL_BA_ERROR_STATE, nullptr, 0, &error_code,
-						sizeof(error_code), &bytes_returned, nullptr) &&
-					bytes_returned)
-					msg = ((error_code & 0xFFFF) >= 0 && (error_code & 0xFFFF) <= 4)
-							  ? error_messages[error_code & 0xFFFF]
-							  : "Unknown error (your driver version might not yet be supported).";
-				else
-					msg = "Could not retrieve error message because the device is closed";
-				CloseHandle(m_hDevice);
-				m_hDevice = nullptr;
-			}
-			QMessageBox::critical(this, "Error",
-				QString("Could not initialize the BrainAmpSeries interface: ") + e.what() +
-					" (driver message: " + msg + ")",
-				QMessageBox::Ok);
-			return;
+void MainWindow::finishCalibration(const ReaderConfig &conf,
+	const std::vector<ChannelCalibration> &result, const std::string &error) {
+	DWORD bytes_returned;
+	calibrator->join();
+	calibrator.reset();
+	DeviceIoControl(m_hDevice, IOCTL_BA_STOP, nullptr, 0, nullptr, 0, &bytes_returned, nullptr);
+	CloseHandle(m_hDevice);
+	m_hDevice = nullptr;
+	ui->statusBar->showMessage("");
+	ui->linkButton->setEnabled(true);
+	ui->calibrateButton->setEnabled(true);
+	ui->deviceSettingsGroup->setEnabled(true);
+	ui->channelLabelsGroup->setEnabled(true);
+	if (!error.empty()) {
+		QMessageBox::critical(this, "Error",
+			QString("The calibration failed: ") + error.c_str(), QMessageBox::Ok);
+		return;
+	}
+
+	const QString filename =
+		save_calibration(conf, ui->calibrationWaveform->currentText(), result);
+	QStringList deviating;
+	for (unsigned int c = 0; c < conf.channelCount; c++)
+		if (!result[c].bWithinTolerance)
+			deviating << QStringLiteral("%1: gain %2 %, phase %3 deg")
+							 .arg(QString::fromStdString(conf.channelLabels[c]))
+							 .arg(100 * (result[c].dGain - 1), 0, 'f', 1)
+							 .arg(result[c].dPhase, 0, 'f', 1);
+	const QString summary =
+		QStringLiteral("The calibration table was saved to %1.\n\n").arg(filename);
+	if (deviating.isEmpty())
+		QMessageBox::information(this, "Calibration",
+			summary + "All channels are within tolerance.", QMessageBox::Ok);
+	else
+		QMessageBox::warning(this, "Calibration",
+			summary + "These channels are outside the tolerance and won't be corrected:\n" +
+				deviating.join('\n'),
+			QMessageBox::Ok);
+}
+
+// JSON value of a setting as the config file would hold it
+static QVariant setting_value(const QJsonValue &value) {
+	if (value.isArray()) {
+		QStringList list;
+		for (const auto &item : value.toArray()) list << setting_value(item).toString();
+		return list;
+	}
+	if (value.isDouble() && value.toDouble() == std::floor(value.toDouble()))
+		return static_cast<qlonglong>(value.toDouble());
+	return value.toVariant();
+}
+
+// changes the given settings and leaves the others as they are; the names are those of the
+// config file, with or without the "settings/" group ("chunksize", "channels/labels")
+void MainWindow::reconfigure(const QJsonObject &settings) {
+	// the current settings plus the changes make up a config file, so the changes are
+	// applied exactly as if that file had been loaded
+	QTemporaryDir dir;
+	const QString filename = dir.filePath("reconfigure.cfg");
+	save_config(filename);
+	{
+		QSettings pt(filename, QSettings::IniFormat);
+		for (auto it = settings.begin(); it != settings.end(); ++it) {
+			const QString key = it.key().contains('/') ? it.key() : "settings/" + it.key();
+			if (!pt.contains(key))
+				throw std::runtime_error("Unknown setting '" + it.key().toStdString() + "'.");
+			pt.setValue(key, setting_value(it.value()));
 		}
+	}
+	load_config(filename);
+}
 
-		// done, all successful
-		ui->linkButton->setText("Unlink");
-		ui->deviceSettingsGroup->setEnabled(false);
-		ui->triggerSettingsGroup->setEnabled(false);
-		ui->channelLabelsGroup->setEnabled(false);
+QJsonObject MainWindow::control_status() {
+	QJsonObject status;
+	const bool failed = counters.failed.load(std::memory_order_acquire);
+	status["linked"] = reader != nullptr;
+	status["acquiring"] = reader != nullptr && !failed;
+	status["calibrating"] = calibrator != nullptr;
+	if (reader && failed) status["error"] = QString::fromStdString(counters.error);
+	if (reader && !counters.latencyFeasible.load(std::memory_order_relaxed)) {
+		const double target_ms = counters.targetLatencyUs.load(std::memory_order_relaxed) / 1e3;
+		const double estimated_ms =
+			counters.estimatedLatencyUs.load(std::memory_order_relaxed) / 1e3;
+		status["warning"] = QString("The latency target of %1 ms can't be met without "
+									"overloading the reader, the estimated latency is %2 ms.")
+								.arg(target_ms)
+								.arg(estimated_ms);
+	}
+	if (reader && counters.scheduled.load(std::memory_order_acquire)) {
+		QJsonObject scheduling{{"realtime", counters.realtime}, {"cpu", counters.readerCpu},
+			{"memory_locked", counters.memoryLocked}};
+		if (counters.jitterMeasured) {
+			scheduling["jitter_p99_before_us"] = counters.jitterBefore.p99;
+			scheduling["jitter_p99_after_us"] = counters.jitterAfter.p99;
+			scheduling["jitter_max_before_us"] = counters.jitterBefore.max;
+			scheduling["jitter_max_after_us"] = counters.jitterAfter.max;
+		}
+		if (!counters.schedulingMessage.empty())
+			scheduling["not_applied"] = QString::fromStdString(counters.schedulingMessage);
+		status["scheduling"] = scheduling;
 	}
+	status["settings"] = QJsonObject{{"samplingrate", ui->cbSamplingRate->currentText().toInt()},
+		{"additionalrates", ui->additionalRates->text()},
+		{"channelcount", ui->channelCount->value()}, {"chunksize", ui->chunkSize->value()},
+		{"latencybudget", ui->latencyBudget->value()},
+		{"sendrawstream", ui->sendRawStream->isChecked()}};
+	status["counters"] = QJsonObject{
+		{"blocks", static_cast<qint64>(counters.blocks.load(std::memory_order_relaxed))},
+		{"samples", static_cast<qint64>(counters.samples.load(std::memory_order_relaxed))},
+		{"incomplete_reads",
+			static_cast<qint64>(counters.incompleteReads.load(std::memory_order_relaxed))},
+		{"block_samples", static_cast<int>(counters.blockLen.load(std::memory_order_relaxed))},
+		{"estimated_latency_us",
+			static_cast<int>(counters.estimatedLatencyUs.load(std::memory_order_relaxed))},
+		{"latency_feasible", counters.latencyFeasible.load(std::memory_order_relaxed)},
+		{"chunk_size_changes",
+			static_cast<int>(counters.chunkSizeChanges.load(std::memory_order_relaxed))},
+		{"block_us", static_cast<int>(counters.lastBlockUs.load(std::memory_order_relaxed))},
+		{"max_block_us", static_cast<int>(counters.maxBlockUs.load(std::memory_order_relaxed))},
+		{"missing_ms", static_cast<qint64>(counters.missingMs.load(std::memory_order_relaxed))},
+		{"device_overflows",
+			static_cast<int>(counters.deviceOverflows.load(std::memory_order_relaxed))},
+		{"dc_corrections",
+			static_cast<int>(counters.dcCorrections.load(std::memory_order_relaxed))},
+		{"dc_correction_failures",
+			static_cast<int>(counters.dcCorrectionFailures.load(std::memory_order_relaxed))},
+		{"dc_correction_error",
+			static_cast<int>(counters.dcCorrectionError.load(std::memory_order_relaxed))},
+		{"external_markers",
+			static_cast<qint64>(counters.externalMarkers.load(std::memory_order_relaxed))},
+		{"late_markers",
+			static_cast<qint64>(counters.lateMarkers.load(std::memory_order_relaxed))},
+		{"future_markers",
+			static_cast<qint64>(counters.futureMarkers.load(std::memory_order_relaxed))},
+		{"marker_inlet_connected",
+			counters.markerInletConnected.load(std::memory_order_relaxed)},
+		{"epochs", static_cast<qint64>(counters.epochs.load(std::memory_order_relaxed))},
+		{"dropped_epochs",
+			static_cast<qint64>(counters.droppedEpochs.load(std::memory_order_relaxed))},
+		{"asr_calibrated", counters.asrCalibrated.load(std::memory_order_relaxed)},
+		{"asr_rejected", counters.asrRejected.load(std::memory_order_relaxed)}};
+	QJsonArray histogram;
+	for (const auto &bucket : counters.blockUsHistogram)
+		histogram.append(static_cast<qint64>(bucket.load(std::memory_order_relaxed)));
+	status["block_us_histogram"] = histogram;
+	std::vector<ChannelQuality> quality;
+	if (qualityMonitor && qualityMonitor->Snapshot(quality)) {
+		int states[4] = {0, 0, 0, 0};
+		for (const auto &q : quality) states[q.state]++;
+		status["quality"] = QJsonObject{{"good", states[ChannelQuality::Good]},
+			{"warning", states[ChannelQuality::Warning]}, {"bad", states[ChannelQuality::Bad]}};
+	}
+	return status;
+}
+
+// one request of the control endpoint: link, unlink, reconfigure (unlinks and links again if
+// linked) or status; every reply carries the status after the command
+QJsonObject MainWindow::control(const QJsonObject &request) {
+	QJsonObject reply;
+	try {
+		const QString command = request["command"].toString();
+		if (command == "link") {
+			if (!reader) link();
+		} else if (command == "unlink") {
+			if (reader) unlink();
+		} else if (command == "reconfigure") {
+			// the reader thread keeps the settings it was started with, so it's restarted
+			const bool relink = reader != nullptr;
+			if (relink) unlink();
+			try {
+				if (request.contains("config")) {
+					const QString filename = request["config"].toString();
+					if (!QFileInfo::exists(filename))
+						throw std::runtime_error(
+							"The config file '" + filename.toStdString() + "' doesn't exist.");
+					load_config(filename);
+				}
+				reconfigure(request["settings"].toObject());
+			} catch (std::exception &) {
+				if (relink) link();
+				throw;
+			}
+			if (relink) link();
+		} else if (command != "status")
+			throw std::runtime_error("Unknown command '" + command.toStdString() +
+									 "', expected link, unlink, reconfigure or status.");
+		reply["ok"] = true;
+	} catch (std::exception &e) {
+		reply["ok"] = false;
+		reply["error"] = e.what();
+	}
+	reply["status"] = control_status();
+	return reply;
+}
+
+// Places the external markers from next on that fall into a chunk of nsamples samples ending
+// at last_ts: numeric ones into the trigger channel (if trigger isn't nullptr), all of them as
+// text into strings (if it isn't nullptr). A marker whose sample has already been sent goes
+// to the first sample of the chunk; if its sample is taken, it goes to the next free one.
+// Returns the number of late markers.
+template <typename T>
+static int place_external_markers(const std::vector<ExternalMarker> &markers, std::size_t &next,
+	T *trigger, unsigned int stride, std::string *strings, int nsamples, double last_ts,
+	double rate) {
+	int late = 0;
+	const double first_ts = last_ts - (nsamples - 1) / rate;
+	for (; next < markers.size(); next++) {
+		const ExternalMarker &marker = markers[next];
+		long s = std::lround((marker.dTimestamp - first_ts) * rate);
+		if (s >= nsamples) break;
+		char *end;
+		const long code = std::strtol(marker.szText, &end, 10);
+		const bool numeric =
+			trigger && end != marker.szText && !*end && code >= 0 && code <= 0xffff;
+		if (s < 0) s = 0;
+		while (s < nsamples && ((numeric && trigger[s * stride] != static_cast<T>(-1)) ||
+								  (strings && !strings[s].empty())))
+			s++;
+		// no free sample left, the marker waits for the next chunk
+		if (s == nsamples) break;
+		if (marker.dTimestamp < first_ts - 0.5 / rate) late++;
+		if (numeric) trigger[s * stride] = static_cast<T>(static_cast<uint16_t>(code));
+		if (strings) strings[s] = marker.szText;
+	}
+	return late;
 }
 
 // background data reader thread
 template <typename T> void MainWindow::read_thread(const ReaderConfig conf) {
-	const float unit_scales[] = {0.1f, 0.5f, 10.f, 152.6f};
 	const char *unit_strings[] = {"100 nV", "500 nV", "10 muV", "152.6 muV"};
 	const bool sendRawStream = std::is_same<T, int16_t>::value;
+	const double hardware_rate = sampling_rates[0];
+	// the first output runs at the selected sampling rate, the others at the additional rates
+	std::vector<int> integer_rates{static_cast<int>(sampling_rate)};
+	integer_rates.insert(
+		integer_rates.end(), conf.additionalRates.begin(), conf.additionalRates.end());
+	const std::vector<double> output_rates(integer_rates.begin(), integer_rates.end());
+	// with a latency target, the block length is picked at runtime
+	unsigned int block_len = block_samples(conf.chunkSize);
+	unsigned int max_block_len = block_len;
+	std::unique_ptr<ChunkSizeController> chunk_controller;
+	if (conf.targetLatencyMs) {
+		const double target_latency = conf.targetLatencyMs / 1000.0;
+		max_block_len =
+			std::max(block_len, static_cast<unsigned int>(2 * target_latency * hardware_rate));
+		chunk_controller.reset(new ChunkSizeController(
+			hardware_rate, auto_block_granularity(), block_len, max_block_len, target_latency));
+		block_len = chunk_controller->BlockLen();
+		max_block_len = chunk_controller->MaxBlockLen();
+		counters.targetLatencyUs.store(
+			static_cast<uint32_t>(target_latency * 1e6), std::memory_order_relaxed);
+	}
 	// reserve buffers to receive and send data
-	unsigned int chunk_words = conf.chunkSize * (conf.channelCount + 1) * downsampling_factor;
-	std::vector<int16_t> recv_buffer(chunk_words, 0);
-	int sz = sizeof(int16_t);
-	int nTransferSz = sz * (int)recv_buffer.size();
-	unsigned int outbufferChannelCount = conf.channelCount + (m_bSampledMarkersEEG ? 1 : 0);
-	std::vector<std::vector<T>> send_buffer_vec(
-		conf.chunkSize, std::vector<T>(outbufferChannelCount));
-	std::vector<T> sample_buffer(outbufferChannelCount, 0);
-	std::vector<T> send_buffer(conf.chunkSize * outbufferChannelCount, 0);
-	std::vector<T> inter_buffer(conf.chunkSize * downsampling_factor, 0);
-	std::vector<Downsampler<T>> downsamplers;
-	bool bDoFiltering = (sampling_rate == 5000) ? false : true;
-	for (int i = 0; i < conf.channelCount; i++)
-		downsamplers.push_back(Downsampler<T>(downsampling_factor, conf.chunkSize, bDoFiltering));
-	downsamplers.push_back(Downsampler<T>(downsampling_factor, conf.chunkSize, false));
-	std::vector<std::string> marker_buffer(conf.chunkSize, std::string());
+	unsigned int chunk_words = block_len * (conf.channelCount + 1);
+	std::vector<int16_t> recv_buffer(max_block_len * (conf.channelCount + 1), 0);
+	// with an AUX rate, the PolyBox channels leave the EEG outputs for an output of their own;
+	// both lists hold indices of received channels
+	const int polyBoxChannels = conf.usePolyBox ? 8 : 0;
+	std::vector<unsigned int> eeg_channels, aux_channels;
+	for (unsigned int c = 0; c < conf.channelCount; c++)
+		if (conf.auxRate && conf.montage[c] <= polyBoxChannels)
+			aux_channels.push_back(c);
+		else
+			eeg_channels.push_back(c);
+	const auto eeg_count = static_cast<unsigned int>(eeg_channels.size());
+	std::vector<std::string> eeg_labels;
+	for (unsigned int c : eeg_channels) eeg_labels.push_back(conf.channelLabels[c]);
+	unsigned int outbufferChannelCount = eeg_count + (m_bSampledMarkersEEG ? 1 : 0);
+	// one decimation tree for all outputs; the trigger channel is picked, not filtered
+	DecimationTree decimator(eeg_count + 1, eeg_count, static_cast<int>(hardware_rate),
+		integer_rates, max_block_len);
+	std::vector<std::vector<T>> send_buffers;
+	for (std::size_t o = 0; o < output_rates.size(); o++)
+		send_buffers.emplace_back(
+			decimator.OutputCapacity(static_cast<int>(o)) * outbufferChannelCount, 0);
 	std::string s_mrkr;
+	// microvolts per bit of each EEG and AUX channel, including the calibration table if one
+	// is applied
+	std::vector<float> channel_scales, aux_scales;
+	for (unsigned int c : eeg_channels)
+		channel_scales.push_back(unit_scales[conf.resolution] *
+								 (conf.channelGains.empty() ? 1.f : conf.channelGains[c]));
+	for (unsigned int c : aux_channels)
+		aux_scales.push_back(unit_scales[conf.resolution] *
+							 (conf.channelGains.empty() ? 1.f : conf.channelGains[c]));
+	// DC-coupled channels drift towards the rails; their offsets are corrected between
+	// triggers, and the data right after a correction is flagged
+	std::unique_ptr<DcOffsetScheduler> dc_scheduler;
+	if (conf.autoDCCorrection)
+		dc_scheduler.reset(new DcOffsetScheduler(conf.channelCount, hardware_rate,
+			dc_offset_limit * std::numeric_limits<int16_t>::max() * unit_scales[conf.resolution]));
+	double gap_start = 0, gap_end = 0;
+	const std::string dc_marker = dc_correction_marker;
+	// markers from an external stream, merged into every output at the sample of their time
+	// stamp; next_external holds the first marker each output hasn't placed yet
+	std::unique_ptr<MarkerInlet> marker_inlet;
+	std::vector<ExternalMarker> external_markers;
+	std::vector<std::size_t> next_external(output_rates.size(), 0);
+	if (!conf.markerInlet.empty()) {
+		marker_inlet.reset(new MarkerInlet(conf.markerInlet));
+		external_markers.reserve(max_external_markers);
+	}
+	// windows around selected trigger codes of the primary output, sent as one chunk each
+	std::unique_ptr<EpochExtractor<T>> epochs;
+	if (!conf.epochTriggers.empty())
+		epochs.reset(new EpochExtractor<T>(eeg_count,
+			static_cast<int>(std::lround(conf.epochPreMs * output_rates[0] / 1000)),
+			std::max(1, static_cast<int>(std::lround(conf.epochPostMs * output_rates[0] / 1000))),
+			decimator.OutputCapacity(0), conf.epochTriggers));
+	// artifact-cleaned copy of the primary output, always in microvolts
+	std::unique_ptr<ArtifactSubspaceReconstruction> asr;
+	std::vector<float> cleaned_buffer;
+	// the last input per channel before a DC offset correction, held through its gap so that
+	// the correction's transient never reaches the cleaning
+	std::vector<double> asr_hold;
+	if (conf.asrCutoff) {
+		asr.reset(new ArtifactSubspaceReconstruction(eeg_count, output_rates[0],
+			decimator.OutputCapacity(0), conf.asrCalibrationSeconds, conf.asrCutoff));
+		cleaned_buffer.resize(decimator.OutputCapacity(0) * eeg_count);
+		asr_hold.resize(eeg_count, 0);
+	}
+	// the AUX channels on the cheap path, at an integer factor below the hardware rate
+	std::unique_ptr<AuxDecimator> aux_decimator;
+	std::vector<T> aux_buffer;
+	const int aux_factor = conf.auxRate ? static_cast<int>(hardware_rate / conf.auxRate) : 1;
+	if (!aux_channels.empty()) {
+		aux_decimator.reset(new AuxDecimator(static_cast<int>(aux_channels.size()), aux_factor,
+			static_cast<int>(max_block_len)));
+		aux_buffer.resize(aux_decimator->OutputCapacity() * aux_channels.size());
+	}
 
 	const std::string streamprefix = "BrainAmpSeries-" + std::to_string(conf.deviceNumber);
 
-	SetPriorityClass(GetCurrentProcess(), HIGH_PRIORITY_CLASS);
+	// raise only this thread's priority and keep the buffers allocated above resident;
+	// the wake-up jitter before and after tells whether it made a difference
+	WakeupJitter jitter_before{0, 0, 0}, jitter_after{0, 0, 0};
+	if (conf.realtimeScheduling) jitter_before = measure_wakeup_jitter();
+	ThreadScheduling scheduling(conf.realtimeScheduling, conf.readerCpu);
+	scheduling.lock(recv_buffer.data(), recv_buffer.size() * sizeof(int16_t));
+	for (auto &send_buffer : send_buffers)
+		scheduling.lock(send_buffer.data(), send_buffer.size() * sizeof(T));
+	if (conf.realtimeScheduling) {
+		jitter_after = measure_wakeup_jitter();
+		counters.jitterMeasured = true;
+		counters.jitterBefore = jitter_before;
+		counters.jitterAfter = jitter_after;
+	}
+	counters.realtime = scheduling.realtime();
+	counters.readerCpu = scheduling.cpu();
+	counters.memoryLocked = scheduling.memory_locked();
+	counters.schedulingMessage = scheduling.message();
+	counters.scheduled.store(true, std::memory_order_release);
 
-	// for keeping track of sampled marker stream data
+	// for keeping track of sampled marker stream data, separately for each output
 	uint16_t mrkr = 0;
-	uint16_t prev_mrkr = 0;
+	std::vector<uint16_t> prev_mrkrs(output_rates.size(), 0);
 
 	// for keeping track of unsampled markers
 	// uint16_t us_prev_mrkr = 0;
 
 	std::unique_ptr<lsl::stream_outlet> marker_outlet;
 	try {
-		// create data streaminfo and append some meta-data
-		auto stream_format = sendRawStream ? lsl::cf_int16 : lsl::cf_float32;
-		lsl::stream_info data_info(streamprefix, "EEG", outbufferChannelCount, sampling_rate,
-			stream_format,
-			streamprefix + '_' + std::to_string(conf.serialNumber) + "_SR-" +
-				std::to_string(sampling_rate));
-		lsl::xml_element channels = data_info.desc().append_child("channels");
-		std::string postprocessing_factor =
-			sendRawStream ? std::to_string(unit_scales[conf.resolution]) : "1";
-		for (const auto &channelLabel : conf.channelLabels)
-			channels.append_child("channel")
-				.append_child_value("label", channelLabel)
-				.append_child_value("type", "EEG")
-				.append_child_value("unit", "microvolts")
-				.append_child_value("scaling_factor", postprocessing_factor);
-		if (m_bSampledMarkersEEG) {
-			channels.append_child("channel")
-				.append_child_value("label", "triggerStream")
-				.append_child_value("type", "EEG")
-				.append_child_value("unit", "code");
-		}
-
-		data_info.desc()
-			.append_child("amplifier")
-			.append_child("settings")
-			.append_child_value("low_impedance_mode", conf.lowImpedanceMode ? "true" : "false")
-			.append_child_value("resolution", unit_strings[conf.resolution])
-			.append_child_value("resolutionfactor", std::to_string(unit_scales[conf.resolution]))
-			.append_child_value("dc_coupling", conf.dcCoupling ? "DC" : "AC");
-		data_info.desc()
-			.append_child("acquisition")
-			.append_child_value("manufacturer", "Brain Products")
-			.append_child_value("serial_number", std::to_string(conf.serialNumber));
-
 		int32_t lslProtocolVersion = lsl::protocol_version();
 		int32_t lslLibVersion = lsl::library_version();
 		std::stringstream ssProt;
@@ -407,30 +1039,256 @@ template <typename T> void MainWindow::read_thread(const ReaderConfig conf) {
 		std::stringstream ssApp;
 		ssApp << APPVERSIONSTREAM(m_AppVersion);
 
-		data_info.desc()
-			.append_child("versions")
-			.append_child_value("lsl_protocol", ssProt.str())
-			.append_child_value("liblsl", ssLSL.str())
-			.append_child_value("App", ssApp.str());
-		// make a data outlet
-		lsl::stream_outlet data_outlet(data_info);
+		// create data streaminfos and append some meta-data
+		std::vector<std::unique_ptr<lsl::stream_outlet>> data_outlets;
+		std::vector<std::unique_ptr<SharedMemoryWriter>> shared_rings;
+		for (std::size_t o = 0; o < output_rates.size(); o++) {
+			auto stream_format = sendRawStream ? lsl::cf_int16 : lsl::cf_float32;
+			const std::string streamname =
+				o == 0 ? streamprefix
+					   : streamprefix + '-' + std::to_string(conf.additionalRates[o - 1]) + "Hz";
+			lsl::stream_info data_info(streamname, "EEG", outbufferChannelCount, output_rates[o],
+				stream_format,
+				streamprefix + '_' + std::to_string(conf.serialNumber) + "_SR-" +
+					std::to_string(output_rates[o]));
+			lsl::xml_element channels = data_info.desc().append_child("channels");
+			for (std::size_t c = 0; c < eeg_count; c++) {
+				// raw samples need the (calibrated) resolution factor, float samples are scaled
+				lsl::xml_element channel =
+					channels.append_child("channel")
+						.append_child_value("label", eeg_labels[c])
+						.append_child_value("type", "EEG")
+						.append_child_value("unit", "microvolts")
+						.append_child_value("scaling_factor",
+							sendRawStream ? std::to_string(channel_scales[c]) : "1")
+						.append_child_value(
+							"amplifier_channel", std::to_string(conf.montage[eeg_channels[c]]));
+				if (!conf.channelGains.empty())
+					channel.append_child_value(
+						"gain_correction", std::to_string(conf.channelGains[eeg_channels[c]]));
+			}
+			if (m_bSampledMarkersEEG) {
+				channels.append_child("channel")
+					.append_child_value("label", "triggerStream")
+					.append_child_value("type", "EEG")
+					.append_child_value("unit", "code");
+			}
+
+			data_info.desc()
+				.append_child("amplifier")
+				.append_child("settings")
+				.append_child_value("low_impedance_mode", conf.lowImpedanceMode ? "true" : "false")
+				.append_child_value("resolution", unit_strings[conf.resolution])
+				.append_child_value(
+					"resolutionfactor", std::to_string(unit_scales[conf.resolution]))
+				.append_child_value("dc_coupling", conf.dcCoupling ? "DC" : "AC");
+			data_info.desc()
+				.append_child("acquisition")
+				.append_child_value("manufacturer", "Brain Products")
+				.append_child_value("serial_number", std::to_string(conf.serialNumber))
+				.append_child_value("hardware_rate", std::to_string(hardware_rate))
+				.append_child_value(
+					"decimation_factor", std::to_string(hardware_rate / output_rates[o]));
+			if (dc_scheduler)
+				data_info.desc()
+					.append_child("dc_offset_correction")
+					.append_child_value("mode", "auto")
+					.append_child_value("limit_fraction", std::to_string(dc_offset_limit))
+					.append_child_value("marker", dc_marker)
+					.append_child_value("gap_seconds", std::to_string(dc_correction_gap))
+					.append_child_value("gap_value", sendRawStream ? "-32768" : "NaN");
+			lsl::xml_element chunking = data_info.desc().append_child("chunking");
+			chunking.append_child_value("mode", chunk_controller ? "auto" : "fixed")
+				.append_child_value("block_samples", std::to_string(block_len));
+			if (chunk_controller)
+				chunking
+					.append_child_value("target_latency_ms", std::to_string(conf.targetLatencyMs))
+					.append_child_value(
+						"block_granularity", std::to_string(chunk_controller->Granularity()))
+					.append_child_value("max_block_samples", std::to_string(max_block_len))
+					.append_child_value(
+						"max_cpu_load", std::to_string(chunk_controller->MaxLoad()))
+					.append_child_value("marker", chunk_size_marker);
+
+			if (conf.realtimeScheduling)
+				data_info.desc()
+					.append_child("scheduling")
+					.append_child_value("realtime", scheduling.realtime() ? "true" : "false")
+					.append_child_value("cpu", std::to_string(scheduling.cpu()))
+					.append_child_value(
+						"memory_locked", scheduling.memory_locked() ? "true" : "false")
+					.append_child_value("jitter_p99_before_us", std::to_string(jitter_before.p99))
+					.append_child_value("jitter_p99_after_us", std::to_string(jitter_after.p99))
+					.append_child_value("jitter_max_before_us", std::to_string(jitter_before.max))
+					.append_child_value("jitter_max_after_us", std::to_string(jitter_after.max));
+
+			if (marker_inlet)
+				data_info.desc()
+					.append_child("external_markers")
+					.append_child_value("stream", conf.markerInlet)
+					.append_child_value("numeric_markers_in_channel",
+						m_bSampledMarkersEEG ? "triggerStream" : "none")
+					.append_child_value("sampled_marker_stream", streamprefix + "-SampledMarkers");
+
+			data_info.desc()
+				.append_child("versions")
+				.append_child_value("lsl_protocol", ssProt.str())
+				.append_child_value("liblsl", ssLSL.str())
+				.append_child_value("App", ssApp.str());
+			// the same chunks for local readers; slots hold the samples of the shortest block and
+			// longer blocks take several, so the ring holds shared_memory_seconds of data
+			if (conf.sharedMemory) {
+				const unsigned int min_block_len =
+					chunk_controller ? chunk_controller->Granularity() : block_len;
+				const int slot_samples = static_cast<int>(
+					std::ceil(min_block_len * output_rates[o] / hardware_rate));
+				shared_rings.emplace_back(new SharedMemoryWriter(streamname, streamname,
+					stream_format, outbufferChannelCount, output_rates[o], slot_samples,
+					static_cast<int>(
+						std::ceil(shared_memory_seconds * output_rates[o] / slot_samples)) +
+						1));
+				data_info.desc()
+					.append_child("shared_memory")
+					.append_child_value("name", streamname)
+					.append_child_value("bytes", std::to_string(shared_rings.back()->Bytes()));
+			}
+			// make a data outlet
+			data_outlets.emplace_back(new lsl::stream_outlet(data_info));
+		}
 
 		//// create marker streaminfo and outlet
 		// create unsampled marker streaminfo and outlet
 
-		if (m_bUnsampledMarkers) {
+		// also carries the DC offset corrections and the chunk size decisions
+		if (m_bUnsampledMarkers || dc_scheduler || chunk_controller) {
 			lsl::stream_info marker_info(streamprefix + "-Markers", "Markers", 1, 0, lsl::cf_string,
 				streamprefix + '_' + std::to_string(conf.serialNumber) + "_markers");
 			marker_outlet.reset(new lsl::stream_outlet(marker_info));
 		}
 
+		// all external markers as text, sample by sample in step with the primary output
+		std::unique_ptr<lsl::stream_outlet> sampled_marker_outlet;
+		std::vector<std::string> sampled_markers;
+		if (marker_inlet) {
+			lsl::stream_info sampled_marker_info(streamprefix + "-SampledMarkers", "Markers", 1,
+				output_rates[0], lsl::cf_string,
+				streamprefix + '_' + std::to_string(conf.serialNumber) + "_sampledmarkers");
+			sampled_marker_info.desc().append_child_value("source_stream", conf.markerInlet);
+			sampled_marker_outlet.reset(new lsl::stream_outlet(sampled_marker_info));
+			sampled_markers.resize(decimator.OutputCapacity(0));
+			// room for the longest marker text, so placing one never allocates
+			for (auto &text : sampled_markers) text.reserve(sizeof(ExternalMarker::szText));
+		}
+
+		std::unique_ptr<lsl::stream_outlet> epoch_outlet;
+		if (epochs) {
+			lsl::stream_info epoch_info(streamprefix + "-Epochs", "EEG", eeg_count + 1,
+				output_rates[0], sendRawStream ? lsl::cf_int16 : lsl::cf_float32,
+				streamprefix + '_' + std::to_string(conf.serialNumber) + "_epochs");
+			lsl::xml_element channels = epoch_info.desc().append_child("channels");
+			for (std::size_t c = 0; c < eeg_count; c++)
+				channels.append_child("channel")
+					.append_child_value("label", eeg_labels[c])
+					.append_child_value("type", "EEG")
+					.append_child_value("unit", "microvolts")
+					.append_child_value("scaling_factor",
+						sendRawStream ? std::to_string(channel_scales[c]) : "1");
+			channels.append_child("channel")
+				.append_child_value("label", "epochCode")
+				.append_child_value("type", "EEG")
+				.append_child_value("unit", "code");
+			QStringList codes;
+			for (uint16_t code : conf.epochTriggers) codes << QString::number(code);
+			// every chunk is one epoch; samples keep the time stamps of the primary output
+			epoch_info.desc()
+				.append_child("epochs")
+				.append_child_value("source_stream", streamprefix)
+				.append_child_value("trigger_codes", codes.join(',').toStdString())
+				.append_child_value("pre_ms", std::to_string(conf.epochPreMs))
+				.append_child_value("post_ms", std::to_string(conf.epochPostMs))
+				.append_child_value("samples", std::to_string(epochs->EpochSamples()));
+			epoch_outlet.reset(new lsl::stream_outlet(epoch_info));
+		}
+
+		std::unique_ptr<lsl::stream_outlet> cleaned_outlet;
+		if (asr) {
+			lsl::stream_info cleaned_info(streamprefix + "-Cleaned", "EEG", eeg_count,
+				output_rates[0], lsl::cf_float32,
+				streamprefix + '_' + std::to_string(conf.serialNumber) + "_cleaned");
+			lsl::xml_element channels = cleaned_info.desc().append_child("channels");
+			for (const auto &channelLabel : eeg_labels)
+				channels.append_child("channel")
+					.append_child_value("label", channelLabel)
+					.append_child_value("type", "EEG")
+					.append_child_value("unit", "microvolts");
+			cleaned_info.desc()
+				.append_child("artifact_subspace_reconstruction")
+				.append_child_value("source_stream", streamprefix)
+				.append_child_value("cutoff_sd", std::to_string(conf.asrCutoff))
+				.append_child_value(
+					"calibration_seconds", std::to_string(conf.asrCalibrationSeconds))
+				.append_child_value("highpass_hz", "0.5");
+			cleaned_outlet.reset(new lsl::stream_outlet(cleaned_info));
+		}
+
+		// the PolyBox AUX channels at their own rate, decimated by aux_decimator
+		std::unique_ptr<lsl::stream_outlet> aux_outlet;
+		if (aux_decimator) {
+			lsl::stream_info aux_info(streamprefix + "-AUX", "AUX",
+				static_cast<int32_t>(aux_channels.size()), hardware_rate / aux_factor,
+				sendRawStream ? lsl::cf_int16 : lsl::cf_float32,
+				streamprefix + '_' + std::to_string(conf.serialNumber) + "_aux");
+			lsl::xml_element channels = aux_info.desc().append_child("channels");
+			for (std::size_t c = 0; c < aux_channels.size(); c++)
+				channels.append_child("channel")
+					.append_child_value("label", conf.channelLabels[aux_channels[c]])
+					.append_child_value("type", "AUX")
+					.append_child_value("unit", "microvolts")
+					.append_child_value(
+						"scaling_factor", sendRawStream ? std::to_string(aux_scales[c]) : "1")
+					.append_child_value(
+						"polybox_channel", std::to_string(conf.montage[aux_channels[c]]));
+			// second order CIC, i.e. a triangular average over two decimation periods
+			aux_info.desc()
+				.append_child("acquisition")
+				.append_child_value("manufacturer", "Brain Products")
+				.append_child_value("serial_number", std::to_string(conf.serialNumber))
+				.append_child_value("hardware_rate", std::to_string(hardware_rate))
+				.append_child_value("decimation_factor", std::to_string(aux_factor))
+				.append_child_value("filter", "cic2");
+			aux_outlet.reset(new lsl::stream_outlet(aux_info));
+		}
+
+		// per-channel quality of the raw data, one sample per window
+		std::unique_ptr<lsl::stream_outlet> quality_outlet;
+		std::vector<float> quality_sample;
+		if (conf.sendQualityStream) {
+			const char *metrics[][2] = {{"saturated", "fraction"}, {"rms", "microvolts"},
+				{"flatline", "seconds"}, {"line50", "microvolts"}, {"line60", "microvolts"}};
+			lsl::stream_info quality_info(streamprefix + "-Quality", "Quality",
+				5 * conf.channelCount, 1.0 / qualityMonitor->WindowLength(), lsl::cf_float32,
+				streamprefix + '_' + std::to_string(conf.serialNumber) + "_quality");
+			lsl::xml_element quality_channels = quality_info.desc().append_child("channels");
+			for (const auto &channelLabel : conf.channelLabels)
+				for (const auto &metric : metrics)
+					quality_channels.append_child("channel")
+						.append_child_value("label", channelLabel + '-' + metric[0])
+						.append_child_value("type", "Quality")
+						.append_child_value("unit", metric[1]);
+			quality_outlet.reset(new lsl::stream_outlet(quality_info));
+			quality_sample.resize(5 * conf.channelCount);
+		}
+
 		// enter transmission loop
 		DWORD bytes_read;
-		const T scale = std::is_same<T, float>::value ? unit_scales[conf.resolution] : 1;
+		unsigned int samples_since_missing_check = 0;
+		// words of the current block that earlier reads returned
+		unsigned int filled_words = 0;
 
 		while (!shutdown) {
-			// read chunk into recv_buffer
-			if (!ReadFile(m_hDevice, &recv_buffer[0], (int)2 * chunk_words, &bytes_read, nullptr))
+			// read (the rest of) the chunk into recv_buffer
+			if (!ReadFile(m_hDevice, &recv_buffer[filled_words], 2 * (chunk_words - filled_words),
+					&bytes_read, nullptr))
 				throw std::runtime_error(
 					"Could not read data, error code " + std::to_string(GetLastError()));
 
@@ -440,7 +1298,10 @@ template <typename T> void MainWindow::read_thread(const ReaderConfig conf) {
 				continue;
 			}
 
-			if (bytes_read != 2 * chunk_words) {
+			filled_words += bytes_read / 2;
+			if (filled_words < chunk_words) {
+				// the driver returned part of the block; keep it and read the rest
+				counters.incompleteReads.fetch_add(1, std::memory_order_relaxed);
 				// check for errors
 				long error_code = 0;
 				if (DeviceIoControl(m_hDevice, IOCTL_BA_ERROR_STATE, nullptr, 0, &error_code,
@@ -453,62 +1314,266 @@ template <typename T> void MainWindow::read_thread(const ReaderConfig conf) {
 				std::this_thread::yield();
 				continue;
 			}
+			filled_words = 0;
 
 			// All checks completed, transform and send the data
 			double now = lsl::local_clock();
 
-			auto recvbuf_it = recv_buffer.cbegin();
-			auto sendbuf_it = send_buffer.begin();
-			auto inter_it = inter_buffer.begin();
+			// deinterleave into the decimator input and run all decimation stages at once
+			for (unsigned int c = 0; c < eeg_count + 1; c++) {
+				double *inter_it = decimator.Input(c);
+				// the trigger word follows the channels
+				auto recvbuf_it = recv_buffer.cbegin() +
+								  (c < eeg_count ? eeg_channels[c] : conf.channelCount);
+				for (unsigned int s = 0; s < block_len; s++, recvbuf_it += conf.channelCount + 1)
+					*inter_it++ = *recvbuf_it;
+			}
+			decimator.Process(block_len);
+
+			if (marker_inlet) {
+				ExternalMarker external;
+				while (external_markers.size() < max_external_markers &&
+					   marker_inlet->Pop(external))
+					if (external.dTimestamp > now + max_external_marker_lead)
+						counters.futureMarkers.fetch_add(1, std::memory_order_relaxed);
+					else
+						external_markers.push_back(external);
+				counters.markerInletConnected.store(
+					marker_inlet->Connected(), std::memory_order_relaxed);
+			}
+
+			for (std::size_t o = 0; o < output_rates.size(); o++) {
+				const int nsamples = decimator.OutputCount(static_cast<int>(o));
+				if (nsamples == 0) continue;
+				// time stamp of the last sample of this output in this block
+				const double last_ts =
+					now - decimator.OutputLag(static_cast<int>(o)) / hardware_rate;
+				std::vector<T> &send_buffer = send_buffers[o];
+				for (unsigned int c = 0; c < eeg_count; c++) {
+					const double *data = decimator.Output(static_cast<int>(o), c);
+					auto sendbuf_it = send_buffer.begin() + c;
+					for (int s = 0; s < nsamples; s++, sendbuf_it += outbufferChannelCount)
+						*sendbuf_it = static_cast<T>(data[s]);
+				}
+				scale_channels(send_buffer.data(), nsamples, outbufferChannelCount, channel_scales);
+				if (last_ts >= gap_start && last_ts - nsamples / output_rates[o] < gap_end)
+					flag_gap(send_buffer.data(), nsamples, outbufferChannelCount, eeg_count,
+						last_ts, output_rates[o], gap_start, gap_end);
+
+				const double *trigger = decimator.Output(static_cast<int>(o), eeg_count);
+				for (int s = 0; s < nsamples; s++) {
+					mrkr = static_cast<uint16_t>(static_cast<int16_t>(trigger[s]));
+					mrkr ^= m_nPullDir;
+
+					if (epochs && o == 0 && mrkr != prev_mrkrs[o] && epochs->IsEpochCode(mrkr))
+						epochs->Trigger(s, mrkr);
+
+					if (m_bSampledMarkersEEG)
+						send_buffer[s * outbufferChannelCount + eeg_count] =
+							((mrkr == prev_mrkrs[o]) ? -1 : static_cast<T>(mrkr));
+
+					// unsampled markers follow the primary output
+					if (m_bUnsampledMarkers && o == 0) {
+						if (mrkr != prev_mrkrs[o]) {
+							s_mrkr = std::to_string((int)mrkr);
+							double ts = (s + 1 - nsamples) / output_rates[o];
+							marker_outlet->push_sample(&s_mrkr, last_ts + ts);
+						}
+					}
+					prev_mrkrs[o] = mrkr;
+				}
+
+				if (marker_inlet) {
+					if (o == 0)
+						for (int s = 0; s < nsamples; s++) sampled_markers[s].clear();
+					const std::size_t first = next_external[o];
+					const int late = place_external_markers(external_markers, next_external[o],
+						m_bSampledMarkersEEG ? send_buffer.data() + eeg_count : nullptr,
+						outbufferChannelCount, o == 0 ? sampled_markers.data() : nullptr,
+						nsamples, last_ts, output_rates[o]);
+					if (o == 0) {
+						sampled_marker_outlet->push_chunk_multiplexed(
+							sampled_markers.data(), nsamples, last_ts);
+						counters.externalMarkers.fetch_add(
+							next_external[o] - first, std::memory_order_relaxed);
+						counters.lateMarkers.fetch_add(late, std::memory_order_relaxed);
+					}
+				}
+
+				// push data chunk into the outlet
+				data_outlets[o]->push_chunk_multiplexed(
+					send_buffer.data(), nsamples * outbufferChannelCount, last_ts);
+				if (!shared_rings.empty())
+					shared_rings[o]->Write(send_buffer.data(), nsamples, last_ts);
+
+				if (epochs && o == 0) {
+					epochs->Append(send_buffer.data(), outbufferChannelCount, nsamples, last_ts,
+						output_rates[o]);
+					while (epochs->NextEpoch())
+						epoch_outlet->push_chunk_multiplexed(epochs->Epoch(),
+							epochs->EpochTimestamps(),
+							epochs->EpochSamples() * (eeg_count + 1));
+					counters.epochs.store(epochs->Epochs(), std::memory_order_relaxed);
+					counters.droppedEpochs.store(epochs->Dropped(), std::memory_order_relaxed);
+				}
+
+				if (asr && o == 0) {
+					const bool in_gap =
+						last_ts >= gap_start && last_ts - nsamples / output_rates[0] < gap_end;
+					for (unsigned int c = 0; c < eeg_count; c++) {
+						const double *data = decimator.Output(0, c);
+						double *asr_in = asr->Input(c);
+						for (int s = 0; s < nsamples; s++) {
+							const double ts = last_ts + (s + 1 - nsamples) / output_rates[0];
+							if (in_gap && ts >= gap_start && ts < gap_end)
+								asr_in[s] = asr_hold[c];
+							else
+								asr_in[s] = asr_hold[c] = data[s] * channel_scales[c];
+						}
+					}
+					asr->Process(nsamples);
+					for (unsigned int c = 0; c < eeg_count; c++) {
+						const double *cleaned = asr->Output(c);
+						auto cleaned_it = cleaned_buffer.begin() + c;
+						for (int s = 0; s < nsamples; s++, cleaned_it += eeg_count)
+							*cleaned_it = static_cast<float>(cleaned[s]);
+					}
+					if (in_gap)
+						flag_gap(cleaned_buffer.data(), nsamples, eeg_count, eeg_count, last_ts,
+							output_rates[0], gap_start, gap_end);
+					cleaned_outlet->push_chunk_multiplexed(
+						cleaned_buffer.data(), nsamples * eeg_count, last_ts);
+					counters.asrCalibrated.store(asr->Calibrated(), std::memory_order_relaxed);
+					counters.asrRejected.store(asr->Rejected(), std::memory_order_relaxed);
+				}
+			}
+
+			if (aux_decimator) {
+				const auto aux_count = static_cast<unsigned int>(aux_channels.size());
+				aux_decimator->Process(
+					recv_buffer.data(), conf.channelCount + 1, aux_channels.data(), block_len);
+				const int nsamples = aux_decimator->OutputCount();
+				const double *aux = aux_decimator->Output();
+				for (unsigned int k = 0; k < nsamples * aux_count; k++)
+					aux_buffer[k] = static_cast<T>(aux[k]);
+				scale_channels(aux_buffer.data(), nsamples, aux_count, aux_scales);
+				const double aux_ts = now - aux_decimator->OutputLag() / hardware_rate;
+				const double aux_rate = hardware_rate / aux_factor;
+				if (aux_ts >= gap_start && aux_ts - nsamples / aux_rate < gap_end)
+					flag_gap(aux_buffer.data(), nsamples, aux_count, aux_count, aux_ts, aux_rate,
+						gap_start, gap_end);
+				if (nsamples)
+					aux_outlet->push_chunk_multiplexed(
+						aux_buffer.data(), nsamples * aux_count, aux_ts);
+			}
 
-			for (unsigned int c = 0; c < conf.channelCount + 1; c++) {
-				inter_it = inter_buffer.begin();
-				for (unsigned int s = 0; s < conf.chunkSize * downsampling_factor; s++)
-					*inter_it++ = *(recvbuf_it + (c + s * (conf.channelCount + 1)));
-				downsamplers[c].Downsample(&inter_buffer[0]);
+			// markers that every output has placed are done
+			if (marker_inlet) {
+				const std::size_t placed =
+					*std::min_element(next_external.begin(), next_external.end());
+				external_markers.erase(external_markers.begin(), external_markers.begin() + placed);
+				for (auto &next : next_external) next -= placed;
 			}
-			// send_buffer_vec.clear();
-			for (unsigned int c = 0; c < conf.channelCount; c++)
-				for (unsigned int s = 0; s < conf.chunkSize; s++)
-					send_buffer_vec[s][c] = downsamplers[c].m_ptDataOut[s] * scale;
-			//*(sendbuf_it + (s * conf.channelCount + c)) = downsamplers[c].m_ptDataOut[s] * scale;
-
-			// inter_it = inter_buffer.begin();
-			// for (unsigned int s = 0; s < conf.chunkSize * downsampling_factor; s++)
-			//	*inter_it++ = *(recvbuf_it + (conf.channelCount + s * (conf.channelCount + 1)));
-			// downsamplers[conf.channelCount].Downsample(&inter_buffer[0]);
-
-			for (int s = 0; s < conf.chunkSize; s++) {
-				mrkr = (uint16_t)downsamplers[conf.channelCount].m_ptDataOut[s];
-				mrkr ^= m_nPullDir;
-
-				if (m_bSampledMarkersEEG)
-					send_buffer_vec[s][conf.channelCount] =
-						((mrkr == prev_mrkr) ? -1 : static_cast<T>(mrkr));
-				// if (m_bSampledMarkersEEG)
-				//	*(sendbuf_it + (s * conf.channelCount + conf.channelCount)) = ((mrkr ==
-				//prev_mrkr) ? -1 : static_cast<T>(mrkr));
-
-				if (m_bUnsampledMarkers) {
-					if (mrkr != prev_mrkr) {
-						s_mrkr = std::to_string((int)mrkr);
-						int num = s + 1 - conf.chunkSize;
-						double dNum = (double)num;
-						double ts = dNum / sampling_rate;
-						marker_outlet->push_sample(
-							&s_mrkr, now + ts); //(double)(s + 1 - conf.chunkSize) / sampling_rate);
+
+			// quality statistics and preview only after the data is out, so they don't add latency
+			previewEnvelope->Process(recv_buffer.data(), block_len);
+			if (qualityMonitor->Process(recv_buffer.data(), block_len)) {
+				if (dc_scheduler) dc_scheduler->UpdateOffsets(qualityMonitor->Result());
+				if (quality_outlet) {
+					auto quality_it = quality_sample.begin();
+					for (const auto &q : qualityMonitor->Result()) {
+						*quality_it++ = q.fSaturated;
+						*quality_it++ = q.fRms;
+						*quality_it++ = q.fFlatline;
+						*quality_it++ = q.fLine50;
+						*quality_it++ = q.fLine60;
 					}
+					quality_outlet->push_sample(quality_sample, now);
 				}
-				prev_mrkr = mrkr;
 			}
+			const bool dc_correction_due =
+				dc_scheduler && dc_scheduler->Process(recv_buffer.data(), block_len);
+
+			const double processing_time = lsl::local_clock() - now;
+			const auto processing_us = static_cast<uint32_t>(processing_time * 1e6);
+			counters.blocks.fetch_add(1, std::memory_order_relaxed);
+			counters.samples.fetch_add(block_len, std::memory_order_relaxed);
+			counters.blockLen.store(block_len, std::memory_order_relaxed);
+			counters.lastBlockUs.store(processing_us, std::memory_order_relaxed);
+			if (processing_us > counters.maxBlockUs.load(std::memory_order_relaxed))
+				counters.maxBlockUs.store(processing_us, std::memory_order_relaxed);
+			const int bucket = std::min(PipelineCounters::histogramBuckets - 1,
+				static_cast<int>(4 * std::log2(processing_us + 1.0)));
+			counters.blockUsHistogram[bucket].fetch_add(1, std::memory_order_relaxed);
 
-			// push data chunk into the outlet
-			data_outlet.push_chunk(send_buffer_vec, now);
-			// data_outlet.push_chunk_multiplexed(send_buffer, now);
+			// the driver reports the data it discarded since the last query, -1 for an overflow
+			// in the amplifier itself
+			samples_since_missing_check += block_len;
+			if (samples_since_missing_check >= missing_check_seconds * hardware_rate) {
+				samples_since_missing_check = 0;
+				long missing_ms = 0;
+				if (DeviceIoControl(m_hDevice, IOCTL_BA_BUFFERMISSING_MS, nullptr, 0, &missing_ms,
+						sizeof(missing_ms), &bytes_read, nullptr)) {
+					if (missing_ms < 0)
+						counters.deviceOverflows.fetch_add(1, std::memory_order_relaxed);
+					else
+						counters.missingMs.fetch_add(missing_ms, std::memory_order_relaxed);
+				}
+			}
+
+			// the correction blocks in the driver, so it's issued after the block's processing
+			// time was taken. It affects every sample after the last one read, including those
+			// still buffered in the driver, which are stamped from the time of this block on.
+			if (dc_correction_due) {
+				if (DeviceIoControl(m_hDevice, IOCTL_BA_DCOFFSET_CORRECTION, nullptr, 0, nullptr,
+						0, &bytes_read, nullptr)) {
+					gap_start = now + 0.5 / hardware_rate;
+					gap_end = lsl::local_clock() + dc_correction_gap;
+					marker_outlet->push_sample(&dc_marker, gap_start);
+					counters.dcCorrections.fetch_add(1, std::memory_order_relaxed);
+				} else {
+					counters.dcCorrectionFailures.fetch_add(1, std::memory_order_relaxed);
+					counters.dcCorrectionError.store(
+						static_cast<int32_t>(GetLastError()), std::memory_order_relaxed);
+				}
+			}
+
+			if (chunk_controller) {
+				chunk_controller->AddMeasurement(block_len, processing_time);
+				if (chunk_controller->WantsBufferFilling()) {
+					long filling_state = 0;
+					if (DeviceIoControl(m_hDevice, IOCTL_BA_BUFFERFILLING_STATE, nullptr, 0,
+							&filling_state, sizeof(filling_state), &bytes_read, nullptr))
+						chunk_controller->SetBufferFilling(filling_state);
+				}
+				const bool was_feasible = chunk_controller->Feasible();
+				const bool changed = chunk_controller->Update();
+				if (changed) {
+					block_len = chunk_controller->BlockLen();
+					chunk_words = block_len * (conf.channelCount + 1);
+				}
+				if (changed || chunk_controller->Feasible() != was_feasible) {
+					const double estimated_latency = chunk_controller->EstimatedLatency();
+					const bool feasible = chunk_controller->Feasible();
+					counters.estimatedLatencyUs.store(
+						static_cast<uint32_t>(estimated_latency * 1e6), std::memory_order_relaxed);
+					counters.latencyFeasible.store(feasible, std::memory_order_relaxed);
+					counters.chunkSizeChanges.store(
+						chunk_controller->Changes(), std::memory_order_relaxed);
+					// the decision takes effect with the next block
+					const std::string chunk_marker = std::string(chunk_size_marker) +
+						" block_samples=" + std::to_string(block_len) + " estimated_latency_ms=" +
+						std::to_string(estimated_latency * 1e3) +
+						" feasible=" + (feasible ? "true" : "false");
+					marker_outlet->push_sample(&chunk_marker, lsl::local_clock());
+				}
+			}
 		}
 	} catch (std::exception &e) {
 		// any other error
 		std::cout << "Exception in read thread: " << e.what();
+		counters.error = e.what();
+		counters.failed.store(true, std::memory_order_release);
 		// QMessageBox::critical(
 		// nullptr, "Error", QString("Error during processing: ") + e.what(), QMessageBox::Ok);
 	}
@@ -548,4 +1613,7 @@ QString MainWindow::find_config_file(const char *filename) {
 	return "";
 }
 
-MainWindow::~MainWindow() noexcept { delete ui; }
+MainWindow::~MainWindow() noexcept {
+	controlServer.reset();
+	delete ui;
+}
@@ -1,7 +1,10 @@
 #ifndef MAINWINDOW_H
 #define MAINWINDOW_H
+#include "threadscheduling.h"
 #include <QMainWindow>
 #include <atomic>
+#include <memory>
+#include <string>
 #include <thread>
 
 #ifdef WIN32
@@ -21,8 +24,101 @@ struct ReaderConfig {
 		V_152microV = 3
 	} resolution;
 	bool dcCoupling, usePolyBox, lowImpedanceMode;
+	unsigned int auxRate; // own output rate of the PolyBox channels, 0 = in the EEG outputs
+	bool autoDCCorrection; // correct DC offsets while recording, only with dcCoupling
+	bool realtimeScheduling; // real-time priority and locked memory for the reader thread
+	int readerCpu;			 // core to pin the reader thread to, -1 = any
+	unsigned int asrCutoff;	 // artifact cleaning threshold in SD, 0 = no cleaned stream
+	unsigned int asrCalibrationSeconds;
+	bool sendQualityStream;
+	bool sharedMemory; // also publish the data streams in shared memory rings
 	unsigned int chunkSize, channelCount, serialNumber;
+	unsigned int targetLatencyMs; // 0: fixed chunkSize, otherwise pick the block length at runtime
 	std::vector<std::string> channelLabels;
+	// 1-based amplifier channel of each output channel (PolyBox channels first, if used)
+	std::vector<int> montage;
+	std::vector<int> additionalRates; // extra outputs, in Hz, decimated from the same acquisition
+	std::vector<float> channelGains; // calibration correction per channel, empty = none
+	std::string markerInlet; // LSL marker stream merged into the outputs, empty = none
+	std::vector<uint16_t> epochTriggers; // codes that start an epoch, empty = no epoch stream
+	unsigned int epochPreMs, epochPostMs; // epoch window before and after the trigger
+};
+
+// progress of the reader thread for status queries; only the reader writes, with relaxed
+// stores once per block
+struct PipelineCounters {
+	std::atomic<uint64_t> blocks{0};		  // blocks read and sent
+	std::atomic<uint64_t> samples{0};		  // hardware samples in these blocks
+	std::atomic<uint64_t> incompleteReads{0}; // reads that returned only part of a block
+	std::atomic<uint32_t> blockLen{0};		  // current block length in hardware samples
+	// auto chunk size mode: the latency expected at the current block length, whether it's
+	// within the target, and how often the block length changed
+	std::atomic<uint32_t> targetLatencyUs{0}, estimatedLatencyUs{0};
+	std::atomic<bool> latencyFeasible{true};
+	std::atomic<uint32_t> chunkSizeChanges{0};
+	std::atomic<uint32_t> lastBlockUs{0}, maxBlockUs{0}; // processing time of a block
+	// data the driver discarded because the reader fell behind, and overflows in the device
+	std::atomic<uint64_t> missingMs{0};
+	std::atomic<uint32_t> deviceOverflows{0};
+	// processing times t in quarter octaves: bucket b counts b <= 4 log2(t / 1 us + 1) < b + 1
+	static const int histogramBuckets = 64;
+	std::atomic<uint32_t> blockUsHistogram[histogramBuckets];
+	std::atomic<uint32_t> dcCorrections{0};
+	// corrections the driver refused, and the error code of the last one
+	std::atomic<uint32_t> dcCorrectionFailures{0};
+	std::atomic<int32_t> dcCorrectionError{0};
+	std::atomic<uint64_t> externalMarkers{0}; // merged from the marker inlet...
+	std::atomic<uint64_t> lateMarkers{0};	  // ...of which arrived after their sample was sent
+	std::atomic<uint64_t> futureMarkers{0};	  // dropped, stamped too far ahead of the data
+	std::atomic<bool> markerInletConnected{false};
+	std::atomic<uint64_t> epochs{0}, droppedEpochs{0}; // sent, and triggers without an epoch
+	std::atomic<bool> asrCalibrated{false};
+	std::atomic<int> asrRejected{0}; // components reconstructed in the last block
+	// the reader thread's scheduling settings and its wake-up jitter (measured only with
+	// real-time scheduling), written once before scheduled is set
+	bool realtime{false}, memoryLocked{false};
+	int readerCpu{-1};
+	bool jitterMeasured{false};
+	WakeupJitter jitterBefore{0, 0, 0}, jitterAfter{0, 0, 0};
+	std::string schedulingMessage; // settings that could not be applied
+	std::atomic<bool> scheduled{false};
+	std::atomic<bool> failed{false}; // the reader quit with an exception...
+	std::string error;				 // ...described here, written before failed is set
+
+	PipelineCounters() { reset(); }
+	void reset() {
+		blocks = 0;
+		samples = 0;
+		incompleteReads = 0;
+		blockLen = 0;
+		targetLatencyUs = 0;
+		estimatedLatencyUs = 0;
+		latencyFeasible = true;
+		chunkSizeChanges = 0;
+		lastBlockUs = 0;
+		maxBlockUs = 0;
+		missingMs = 0;
+		deviceOverflows = 0;
+		for (auto &bucket : blockUsHistogram) bucket = 0;
+		dcCorrections = 0;
+		dcCorrectionFailures = 0;
+		dcCorrectionError = 0;
+		externalMarkers = 0;
+		lateMarkers = 0;
+		futureMarkers = 0;
+		markerInletConnected = false;
+		epochs = 0;
+		droppedEpochs = 0;
+		asrCalibrated = false;
+		asrRejected = 0;
+		scheduled = false;
+		realtime = memoryLocked = jitterMeasured = false;
+		readerCpu = -1;
+		jitterBefore = jitterAfter = WakeupJitter{0, 0, 0};
+		schedulingMessage.clear();
+		failed = false;
+		error.clear();
+	}
 };
 
 struct t_AppVersion
@@ -32,13 +128,20 @@ struct t_AppVersion
 	int32_t Bugfix;
 };
 
+struct ChannelCalibration;
+class ControlServer;
+class QJsonObject;
+class PreviewEnvelope;
+class SignalQualityMonitor;
 namespace Ui {
 class MainWindow;
 }
 class MainWindow : public QMainWindow {
 	Q_OBJECT
 public:
-	explicit MainWindow(QWidget *parent, const char *config_file);
+	// control_name: name of the local control endpoint, nullptr for none
+	explicit MainWindow(
+		QWidget *parent, const char *config_file, const char *control_name = nullptr);
 	~MainWindow() noexcept override;
 
 private slots:
@@ -50,6 +153,8 @@ private slots:
 	void UpdateChannelLabels();
 	void UpdateChannelLabelsGUI(int);
 	void setSamplingRate();
+	// run the amplifier's calibration generator and save a correction table
+	void calibrate();
 
 private:
 	// function for loading / saving the config file
@@ -57,12 +162,33 @@ private:
 	// background data reader thread
 	template <typename T>
 	void read_thread(const ReaderConfig config);
+	void calibration_thread(const ReaderConfig config);
+	void finishCalibration(const ReaderConfig &config,
+		const std::vector<ChannelCalibration> &result, const std::string &error);
+
+	ReaderConfig gui_config();
+	void open_device(ReaderConfig &config, long block_len);
+	std::string close_failed_device();
+	void report_device_error(const QString &context, const std::exception &e);
+	// throw on failure, toggleRecording() and the control endpoint report it
+	void link();
+	void unlink();
+
+	// requests of the control endpoint, in the GUI thread
+	QJsonObject control(const QJsonObject &request);
+	QJsonObject control_status();
+	void reconfigure(const QJsonObject &settings);
 
 	// raw config file IO
 	void load_config(const QString &filename);
 	void save_config(const QString &filename);
 	std::unique_ptr<std::thread> reader{nullptr};
+	std::unique_ptr<std::thread> calibrator{nullptr};
 	HANDLE m_hDevice{nullptr};
+	std::shared_ptr<SignalQualityMonitor> qualityMonitor;
+	std::shared_ptr<PreviewEnvelope> previewEnvelope;
+	std::unique_ptr<ControlServer> controlServer;
+	PipelineCounters counters;
 
 	bool m_bUnsampledMarkers{false};
 	bool m_bSampledMarkersEEG{false};
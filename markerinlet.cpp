@@ -0,0 +1,67 @@
+#include "markerinlet.h"
+#include <cstring>
+#include <lsl_cpp.h>
+
+MarkerInlet::MarkerInlet(const std::string& sStreamName, int nCapacity)
+	: m_sStreamName(sStreamName), m_ring(nCapacity), m_nWritten(0), m_nRead(0), m_nDropped(0),
+	  m_bConnected(false), m_bShutdown(false)
+{
+	m_thread = std::thread(&MarkerInlet::Run, this);
+}
+
+MarkerInlet::~MarkerInlet()
+{
+	m_bShutdown = true;
+	m_thread.join();
+}
+
+bool MarkerInlet::Pop(ExternalMarker& marker)
+{
+	const uint64_t nRead = m_nRead.load(std::memory_order_relaxed);
+	if (nRead == m_nWritten.load(std::memory_order_acquire)) return false;
+	marker = m_ring[nRead % m_ring.size()];
+	m_nRead.store(nRead + 1, std::memory_order_release);
+	return true;
+}
+
+void MarkerInlet::Run()
+{
+	// short timeouts, so that shutting down never takes long
+	const double dTimeout = 0.2;
+	std::vector<std::string> sample;
+	while (!m_bShutdown)
+	{
+		try
+		{
+			std::vector<lsl::stream_info> results =
+				lsl::resolve_stream("name", m_sStreamName, 1, dTimeout);
+			if (results.empty()) continue;
+			lsl::stream_inlet inlet(results[0], 360, 0, true);
+			inlet.set_postprocessing(lsl::post_clocksync);
+			inlet.open_stream(dTimeout);
+			m_bConnected = true;
+			while (!m_bShutdown)
+			{
+				const double dTimestamp = inlet.pull_sample(sample, dTimeout);
+				if (dTimestamp == 0.0 || sample.empty()) continue;
+				const uint64_t nWritten = m_nWritten.load(std::memory_order_relaxed);
+				if (nWritten - m_nRead.load(std::memory_order_acquire) == m_ring.size())
+				{
+					m_nDropped.fetch_add(1, std::memory_order_relaxed);
+					continue;
+				}
+				ExternalMarker& marker = m_ring[nWritten % m_ring.size()];
+				marker.dTimestamp = dTimestamp;
+				std::strncpy(marker.szText, sample[0].c_str(), sizeof(marker.szText) - 1);
+				marker.szText[sizeof(marker.szText) - 1] = 0;
+				m_nWritten.store(nWritten + 1, std::memory_order_release);
+			}
+		}
+		catch (std::exception&)
+		{
+			// the sender went away (lost_error) or didn't answer; look for it again
+			m_bConnected = false;
+		}
+	}
+	m_bConnected = false;
+}
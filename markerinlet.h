@@ -0,0 +1,43 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A marker pulled from the external stream, with its time stamp in the local clock
+struct ExternalMarker
+{
+	double dTimestamp;
+	char szText[64]; // truncated, always zero-terminated
+};
+
+// Subscribes to an LSL marker stream (e.g. from the stimulus software) on its own thread and
+// hands the markers to the reader thread through a single-producer single-consumer ring, so
+// the reader never waits for the network or the inlet and never allocates. The stream is
+// looked up by name and followed across restarts of the sender; time stamps are mapped to the
+// local clock with LSL's clock synchronization.
+class MarkerInlet
+{
+private:
+	std::string m_sStreamName;
+	std::vector<ExternalMarker> m_ring;
+	std::atomic<uint64_t> m_nWritten, m_nRead;
+	std::atomic<uint64_t> m_nDropped; // markers that found the ring full
+	std::atomic<bool> m_bConnected, m_bShutdown;
+	std::thread m_thread;
+
+	void Run();
+
+public:
+	MarkerInlet(const std::string& sStreamName, int nCapacity = 1024);
+	~MarkerInlet();
+	MarkerInlet(const MarkerInlet&) = delete;
+	MarkerInlet& operator=(const MarkerInlet&) = delete;
+
+	// reader thread: the oldest marker not taken yet; false if there's none
+	bool Pop(ExternalMarker& marker);
+	bool Connected() const { return m_bConnected.load(std::memory_order_relaxed); }
+	uint64_t Dropped() const { return m_nDropped.load(std::memory_order_relaxed); }
+	const std::string& StreamName() const { return m_sStreamName; }
+};
@@ -0,0 +1,77 @@
+#include "previewenvelope.h"
+#include <algorithm>
+#include <cmath>
+
+// columns are published in batches of this many, about 30 times a second for the defaults
+static const int nPublishColumns = 2;
+
+PreviewEnvelope::PreviewEnvelope(
+	int nChannels, double dSamplingRate, float fUnitScale, int nColumns, double dSeconds)
+	: m_nChannels(nChannels), m_nStride(nChannels + 1), m_nColumns(nColumns),
+	  m_nSamplesPerColumn(
+		  std::max(1, static_cast<int>(std::lround(dSamplingRate * dSeconds / nColumns)))),
+	  m_fUnitScale(fUnitScale), m_nColumnPos(0), m_pnMin(nChannels, INT16_MAX),
+	  m_pnMax(nChannels, INT16_MIN), m_nLastPublish(0), m_nBack(0), m_nFront(1), m_nMiddle(2)
+{
+	m_ring.pfMin.assign(nColumns * nChannels, 0.f);
+	m_ring.pfMax.assign(nColumns * nChannels, 0.f);
+	m_ring.nColumns = 0;
+	for (auto& frame : m_frames) frame = m_ring;
+}
+
+void PreviewEnvelope::Process(const int16_t* pnData, int nSamples)
+{
+	for (int s = 0; s < nSamples; s++, pnData += m_nStride)
+	{
+		const int16_t* __restrict pnX = pnData;
+		int16_t* __restrict pnMin = m_pnMin.data();
+		int16_t* __restrict pnMax = m_pnMax.data();
+		for (int c = 0; c < m_nChannels; c++)
+		{
+			pnMin[c] = std::min(pnMin[c], pnX[c]);
+			pnMax[c] = std::max(pnMax[c], pnX[c]);
+		}
+		if (++m_nColumnPos == m_nSamplesPerColumn) FinishColumn();
+	}
+}
+
+void PreviewEnvelope::FinishColumn()
+{
+	const int nOffset = static_cast<int>(m_ring.nColumns % m_nColumns) * m_nChannels;
+	for (int c = 0; c < m_nChannels; c++)
+	{
+		m_ring.pfMin[nOffset + c] = m_pnMin[c] * m_fUnitScale;
+		m_ring.pfMax[nOffset + c] = m_pnMax[c] * m_fUnitScale;
+		m_pnMin[c] = INT16_MAX;
+		m_pnMax[c] = INT16_MIN;
+	}
+	m_ring.nColumns++;
+	m_nColumnPos = 0;
+	if (m_ring.nColumns - m_nLastPublish >= nPublishColumns) Publish();
+}
+
+void PreviewEnvelope::Publish()
+{
+	// bring the back frame up to date by copying only the columns it's missing. That is
+	// usually the last two or three publications; a frame the GUI held on to for longer
+	// (while it was busy or minimised) can be missing up to all of them, which costs one
+	// whole frame at most
+	Frame& back = m_frames[m_nBack];
+	const int64_t nFirst = std::max(back.nColumns, m_ring.nColumns - m_nColumns);
+	for (int64_t col = nFirst; col < m_ring.nColumns; col++)
+	{
+		const int nOffset = static_cast<int>(col % m_nColumns) * m_nChannels;
+		std::copy_n(&m_ring.pfMin[nOffset], m_nChannels, &back.pfMin[nOffset]);
+		std::copy_n(&m_ring.pfMax[nOffset], m_nChannels, &back.pfMax[nOffset]);
+	}
+	back.nColumns = m_ring.nColumns;
+	m_nBack = m_nMiddle.exchange(m_nBack | nDirty, std::memory_order_acq_rel) & ~nDirty;
+	m_nLastPublish = m_ring.nColumns;
+}
+
+const PreviewEnvelope::Frame& PreviewEnvelope::AcquireFrame()
+{
+	if (m_nMiddle.load(std::memory_order_relaxed) & nDirty)
+		m_nFront = m_nMiddle.exchange(m_nFront, std::memory_order_acq_rel) & ~nDirty;
+	return m_frames[m_nFront];
+}
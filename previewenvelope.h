@@ -0,0 +1,54 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// Min/max envelope of the raw signal, one column per display pixel, for a scrolling
+// preview. The reader thread reduces each block to columns of a fixed duration and
+// publishes them through a lock-free triple buffer; the GUI takes the newest frame whenever
+// it repaints. Neither side ever waits for the other, and the amount of data handed over
+// per second depends on the display width, not on the sampling rate.
+class PreviewEnvelope
+{
+public:
+	struct Frame
+	{
+		std::vector<float> pfMin, pfMax; // microvolts, [column % Columns() * nChannels + c]
+		int64_t nColumns;				 // total number of columns written into this frame
+	};
+
+private:
+	int m_nChannels;
+	int m_nStride; // words per multiplexed sample (channels + trigger)
+	int m_nColumns;
+	int m_nSamplesPerColumn;
+	float m_fUnitScale;
+
+	// column in progress and all columns so far (ring of m_nColumns), writer side only
+	int m_nColumnPos;
+	std::vector<int16_t> m_pnMin, m_pnMax;
+	Frame m_ring;
+	int64_t m_nLastPublish;
+
+	// triple buffer: the writer owns m_nBack, the reader m_nFront, m_nMiddle is exchanged
+	Frame m_frames[3];
+	int m_nBack, m_nFront;
+	std::atomic<int> m_nMiddle; // frame index | dirty flag
+	static const int nDirty = 4;
+
+	void FinishColumn();
+	void Publish();
+
+public:
+	// dSeconds: time span covered by nColumns columns
+	PreviewEnvelope(int nChannels, double dSamplingRate, float fUnitScale, int nColumns = 512,
+		double dSeconds = 10.0);
+
+	// writer (reader thread): nSamples multiplexed raw samples incl. the trigger word
+	void Process(const int16_t* pnData, int nSamples);
+
+	// reader (GUI thread): the newest published frame; valid until the next call
+	const Frame& AcquireFrame();
+	int Channels() const { return m_nChannels; }
+	int Columns() const { return m_nColumns; }
+};
@@ -0,0 +1,71 @@
+#include "qualitygrid.h"
+#include <QHelpEvent>
+#include <QPainter>
+#include <QToolTip>
+#include <algorithm>
+
+ChannelQualityGrid::ChannelQualityGrid(QWidget *parent) : QWidget(parent) {
+	setMinimumHeight(cellHeight);
+}
+
+void ChannelQualityGrid::setChannelLabels(const std::vector<std::string> &labels) {
+	this->labels = labels;
+	quality.clear();
+	setMinimumHeight(cellHeight * std::max<int>(1, (labels.size() + columns - 1) / columns));
+	update();
+}
+
+void ChannelQualityGrid::setQuality(const std::vector<ChannelQuality> &quality) {
+	this->quality = quality;
+	update();
+}
+
+void ChannelQualityGrid::clearQuality() {
+	quality.clear();
+	update();
+}
+
+int ChannelQualityGrid::cellAt(int x, int y) const {
+	const int cellWidth = std::max(1, width() / columns);
+	const int cell = (y / cellHeight) * columns + x / cellWidth;
+	return (x / cellWidth < columns && cell < static_cast<int>(labels.size())) ? cell : -1;
+}
+
+void ChannelQualityGrid::paintEvent(QPaintEvent *) {
+	static const QColor colors[] = {
+		QColor(Qt::lightGray), QColor(80, 200, 80), QColor(240, 200, 40), QColor(220, 60, 60)};
+	QPainter painter(this);
+	const int cellWidth = std::max(1, width() / columns);
+	for (int c = 0; c < static_cast<int>(labels.size()); c++) {
+		const QRect cell((c % columns) * cellWidth, (c / columns) * cellHeight, cellWidth - 1,
+			cellHeight - 1);
+		const auto state =
+			c < static_cast<int>(quality.size()) ? quality[c].state : ChannelQuality::Unknown;
+		painter.fillRect(cell, colors[state]);
+		painter.setPen(Qt::black);
+		painter.drawText(cell, Qt::AlignCenter, QString::fromStdString(labels[c]));
+	}
+}
+
+bool ChannelQualityGrid::event(QEvent *ev) {
+	if (ev->type() != QEvent::ToolTip) return QWidget::event(ev);
+	auto *help = static_cast<QHelpEvent *>(ev);
+	const int c = cellAt(help->pos().x(), help->pos().y());
+	if (c < 0 || c >= static_cast<int>(quality.size())) {
+		QToolTip::hideText();
+		ev->ignore();
+		return true;
+	}
+	const ChannelQuality &q = quality[c];
+	QToolTip::showText(help->globalPos(),
+		QStringLiteral("%1\nsaturated: %2 %\nRMS: %3 uV\nflat: %4 s\n50 Hz: %5 uV\n60 Hz: %6 uV\n"
+					   "offset: %7 uV")
+			.arg(QString::fromStdString(labels[c]))
+			.arg(100 * q.fSaturated, 0, 'f', 1)
+			.arg(q.fRms, 0, 'f', 1)
+			.arg(q.fFlatline, 0, 'f', 2)
+			.arg(q.fLine50, 0, 'f', 1)
+			.arg(q.fLine60, 0, 'f', 1)
+			.arg(q.fOffset, 0, 'f', 0));
+	return true;
+}
@@ -0,0 +1,32 @@
+#ifndef QUALITYGRID_H
+#define QUALITYGRID_H
+#include "qualitymonitor.h"
+#include <QWidget>
+#include <string>
+#include <vector>
+
+// Color-coded grid with one cell per channel (gray: no data yet, green: good, yellow:
+// line noise / high amplitude / occasional clipping, red: saturated or flat); hovering a
+// cell shows the numbers behind its color.
+class ChannelQualityGrid : public QWidget {
+	Q_OBJECT
+public:
+	explicit ChannelQualityGrid(QWidget *parent = nullptr);
+	void setChannelLabels(const std::vector<std::string> &labels);
+	void setQuality(const std::vector<ChannelQuality> &quality);
+	// back to the 'no data' state, e.g. after unlinking
+	void clearQuality();
+
+protected:
+	void paintEvent(QPaintEvent *ev) override;
+	bool event(QEvent *ev) override;
+
+private:
+	int cellAt(int x, int y) const;
+	std::vector<std::string> labels;
+	std::vector<ChannelQuality> quality;
+	static const int columns = 8;
+	static const int cellHeight = 18;
+};
+
+#endif // QUALITYGRID_H
@@ -0,0 +1,130 @@
+#include "qualitymonitor.h"
+#include <algorithm>
+#include <cmath>
+
+SignalQualityMonitor::SignalQualityMonitor(
+	int nChannels, double dSamplingRate, double dUnitScale, double dWindow)
+	: m_nChannels(nChannels), m_nStride(nChannels + 1), m_dSamplingRate(dSamplingRate),
+	  m_dUnitScale(dUnitScale), m_nWindowLen(static_cast<int>(dWindow * dSamplingRate)),
+	  m_nWindowPos(0), m_pnPrev(nChannels, 0), m_pnSaturated(nChannels, 0),
+	  m_pnFlatRun(nChannels, 0), m_pnFlatMax(nChannels, 0), m_pdSum(nChannels, 0),
+	  m_pdSumSq(nChannels, 0), m_pdS50a(nChannels, 0), m_pdS50b(nChannels, 0),
+	  m_pdS60a(nChannels, 0), m_pdS60b(nChannels, 0), m_result(nChannels), m_bHaveResult(false)
+{
+	const double dPi = 3.14159265358979323846;
+	m_dK50 = 2 * std::cos(2 * dPi * 50 / dSamplingRate);
+	m_dK60 = 2 * std::cos(2 * dPi * 60 / dSamplingRate);
+	for (auto& quality : m_result) quality = ChannelQuality{0, 0, 0, 0, 0, 0, ChannelQuality::Unknown};
+}
+
+// The per-sample kernels take __restrict parameters and keep integer and floating point
+// work in separate loops, so the compiler vectorizes both over the channels.
+static void UpdateSaturationAndFlatline(int nChannels, const int16_t* __restrict pnX,
+	int16_t* __restrict pnPrev, int32_t* __restrict pnSaturated, int32_t* __restrict pnFlatRun,
+	int32_t* __restrict pnFlatMax)
+{
+	for (int c = 0; c < nChannels; c++)
+	{
+		const int16_t nX = pnX[c];
+		pnSaturated[c] += (nX == 32767) | (nX == -32768);
+		pnFlatRun[c] = (nX == pnPrev[c]) ? pnFlatRun[c] + 1 : 0;
+		pnFlatMax[c] = std::max(pnFlatMax[c], pnFlatRun[c]);
+		pnPrev[c] = nX;
+	}
+}
+
+static void UpdateMoments(int nChannels, const int16_t* __restrict pnX, double* __restrict pdSum,
+	double* __restrict pdSumSq)
+{
+	for (int c = 0; c < nChannels; c++)
+	{
+		const double dX = static_cast<int32_t>(pnX[c]);
+		pdSum[c] += dX;
+		pdSumSq[c] += dX * dX;
+	}
+}
+
+// one Goertzel iteration per channel
+static void UpdateGoertzel(int nChannels, const int16_t* __restrict pnX, double dK,
+	double* __restrict pdS1, double* __restrict pdS2)
+{
+	for (int c = 0; c < nChannels; c++)
+	{
+		const double dS0 = static_cast<int32_t>(pnX[c]) + dK * pdS1[c] - pdS2[c];
+		pdS2[c] = pdS1[c];
+		pdS1[c] = dS0;
+	}
+}
+
+void SignalQualityMonitor::ProcessSample(const int16_t* pnSample)
+{
+	UpdateSaturationAndFlatline(m_nChannels, pnSample, m_pnPrev.data(), m_pnSaturated.data(),
+		m_pnFlatRun.data(), m_pnFlatMax.data());
+	UpdateMoments(m_nChannels, pnSample, m_pdSum.data(), m_pdSumSq.data());
+	UpdateGoertzel(m_nChannels, pnSample, m_dK50, m_pdS50a.data(), m_pdS50b.data());
+	UpdateGoertzel(m_nChannels, pnSample, m_dK60, m_pdS60a.data(), m_pdS60b.data());
+}
+
+void SignalQualityMonitor::FinishWindow()
+{
+	const double dN = m_nWindowLen;
+	for (int c = 0; c < m_nChannels; c++)
+	{
+		ChannelQuality& q = m_result[c];
+		const double dMean = m_pdSum[c] / dN;
+		const double dVar = std::max(0.0, m_pdSumSq[c] / dN - dMean * dMean);
+		const double dP50 = m_pdS50a[c] * m_pdS50a[c] + m_pdS50b[c] * m_pdS50b[c] -
+							m_dK50 * m_pdS50a[c] * m_pdS50b[c];
+		const double dP60 = m_pdS60a[c] * m_pdS60a[c] + m_pdS60b[c] * m_pdS60b[c] -
+							m_dK60 * m_pdS60a[c] * m_pdS60b[c];
+		q.fSaturated = static_cast<float>(m_pnSaturated[c] / dN);
+		q.fRms = static_cast<float>(std::sqrt(dVar) * m_dUnitScale);
+		q.fFlatline = static_cast<float>(m_pnFlatMax[c] / m_dSamplingRate);
+		q.fLine50 = static_cast<float>(2 * std::sqrt(std::max(0.0, dP50)) / dN * m_dUnitScale);
+		q.fLine60 = static_cast<float>(2 * std::sqrt(std::max(0.0, dP60)) / dN * m_dUnitScale);
+		q.fOffset = static_cast<float>(dMean * m_dUnitScale);
+		if (q.fSaturated > 0.01f || q.fFlatline >= 0.5f)
+			q.state = ChannelQuality::Bad;
+		else if (q.fSaturated > 0 || q.fRms > 150.f || std::max(q.fLine50, q.fLine60) > 20.f)
+			q.state = ChannelQuality::Warning;
+		else
+			q.state = ChannelQuality::Good;
+
+		m_pnSaturated[c] = 0;
+		m_pnFlatMax[c] = m_pnFlatRun[c];
+		m_pdSum[c] = m_pdSumSq[c] = 0;
+		m_pdS50a[c] = m_pdS50b[c] = m_pdS60a[c] = m_pdS60b[c] = 0;
+	}
+	m_nWindowPos = 0;
+
+	// the reader never waits for the GUI: if the GUI holds the lock, it gets the next window
+	std::unique_lock<std::mutex> lock(m_sharedMutex, std::try_to_lock);
+	if (lock.owns_lock())
+	{
+		m_shared = m_result;
+		m_bHaveResult = true;
+	}
+}
+
+bool SignalQualityMonitor::Process(const int16_t* pnData, int nSamples)
+{
+	bool bFinished = false;
+	for (int s = 0; s < nSamples; s++, pnData += m_nStride)
+	{
+		ProcessSample(pnData);
+		if (++m_nWindowPos == m_nWindowLen)
+		{
+			FinishWindow();
+			bFinished = true;
+		}
+	}
+	return bFinished;
+}
+
+bool SignalQualityMonitor::Snapshot(std::vector<ChannelQuality>& result)
+{
+	std::lock_guard<std::mutex> lock(m_sharedMutex);
+	if (!m_bHaveResult) return false;
+	result = m_shared;
+	return true;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+struct ChannelQuality
+{
+	enum State : uint8_t { Unknown, Good, Warning, Bad };
+	float fSaturated; // fraction of samples at the int16 rails
+	float fRms;		  // standard deviation in microvolts
+	float fFlatline;  // longest run of identical samples in seconds
+	float fLine50;	  // 50 Hz amplitude in microvolts
+	float fLine60;	  // 60 Hz amplitude in microvolts
+	float fOffset;	  // mean in microvolts, i.e. the DC offset of DC-coupled channels
+	State state;
+};
+
+// Per-channel signal quality computed incrementally from the raw int16 blocks as they come
+// from the driver. All statistics are updated in a single pass over each multiplexed sample;
+// the inner loops run over the channels of one sample with independent per-channel arrays
+// and no branches, so the compiler vectorizes them. Results are produced once per window.
+class SignalQualityMonitor
+{
+private:
+	int m_nChannels;
+	int m_nStride; // words per multiplexed sample (channels + trigger)
+	double m_dSamplingRate;
+	double m_dUnitScale;
+	int m_nWindowLen;
+	int m_nWindowPos;
+	double m_dK50, m_dK60; // Goertzel coefficients
+
+	std::vector<int16_t> m_pnPrev;
+	std::vector<int32_t> m_pnSaturated, m_pnFlatRun, m_pnFlatMax;
+	std::vector<double> m_pdSum, m_pdSumSq;
+	std::vector<double> m_pdS50a, m_pdS50b, m_pdS60a, m_pdS60b; // Goertzel states
+
+	std::vector<ChannelQuality> m_result;
+	std::vector<ChannelQuality> m_shared;
+	std::mutex m_sharedMutex;
+	bool m_bHaveResult;
+
+	void ProcessSample(const int16_t* pnSample);
+	void FinishWindow();
+
+public:
+	SignalQualityMonitor(int nChannels, double dSamplingRate, double dUnitScale,
+		double dWindow = 1.0);
+
+	// pnData: nSamples multiplexed samples of nChannels data words plus one trigger word;
+	// returns true if at least one window was completed
+	bool Process(const int16_t* pnData, int nSamples);
+	// result of the last completed window (reader thread only)
+	const std::vector<ChannelQuality>& Result() const { return m_result; }
+	// copy of the last result for other threads; false if there's none yet
+	bool Snapshot(std::vector<ChannelQuality>& result);
+	double WindowLength() const { return m_nWindowLen / m_dSamplingRate; }
+};
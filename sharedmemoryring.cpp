@@ -0,0 +1,335 @@
+#include "sharedmemoryring.h"
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+	"the ring needs lock-free atomics to be shared between processes");
+static_assert(sizeof(SharedRingSlot) == 64, "slot headers are one cache line");
+
+static const uint64_t cache_line = 64;
+
+static uint64_t round_up(uint64_t nBytes)
+{
+	return (nBytes + cache_line - 1) / cache_line * cache_line;
+}
+
+int shared_ring_value_bytes(int nFormat)
+{
+	return nFormat == 1 ? 4 : nFormat == 5 ? 2 : 0;
+}
+
+#if defined(_WIN32)
+static std::string segment_name(const std::string& sName) { return "Local\\" + sName; }
+
+static std::string last_error()
+{
+	return "error code " + std::to_string(GetLastError());
+}
+#else
+static std::string segment_name(const std::string& sName) { return "/" + sName; }
+
+static std::string last_error() { return std::strerror(errno); }
+
+// true if the segment of that name was left behind by a writer that has gone away: it was
+// closed, never got ready, or no process holds the writer's lock on it any more (the lock
+// goes with the writer's process, so this also catches a crashed writer)
+static bool stale_segment(const std::string& sSegment)
+{
+	const int fd = shm_open(sSegment.c_str(), O_RDONLY, 0);
+	if (fd < 0) return errno == ENOENT;
+	bool bStale = false;
+	struct stat status;
+	if (fstat(fd, &status) == 0 && static_cast<uint64_t>(status.st_size) >= sizeof(SharedRingHeader))
+	{
+		void* pMapping = mmap(nullptr, sizeof(SharedRingHeader), PROT_READ, MAP_SHARED, fd, 0);
+		if (pMapping != MAP_FAILED)
+		{
+			const SharedRingHeader* pHeader = static_cast<const SharedRingHeader*>(pMapping);
+			bStale = pHeader->nMagic.load(std::memory_order_acquire) == SharedRingHeader::magic &&
+					 pHeader->nClosed.load(std::memory_order_acquire) != 0;
+			munmap(pMapping, sizeof(SharedRingHeader));
+		}
+	}
+	if (!bStale && flock(fd, LOCK_SH | LOCK_NB) == 0)
+	{
+		bStale = true;
+		flock(fd, LOCK_UN);
+	}
+	close(fd);
+	return bStale;
+}
+#endif
+
+SharedMemoryWriter::SharedMemoryWriter(const std::string& sName, const std::string& sStreamName,
+	int nFormat, int nChannels, double dRate, int nSlotSamples, int nSlots)
+	: m_sName(segment_name(sName)), m_pMapping(nullptr), m_nBytes(0), m_hHandle(0),
+	  m_pHeader(nullptr), m_nWritten(0), m_nSamples(0)
+{
+	const int nValueBytes = shared_ring_value_bytes(nFormat);
+	if (!nValueBytes || nChannels < 1 || nSlotSamples < 1 || nSlots < 1)
+		throw std::runtime_error("Invalid shared memory ring layout.");
+	const uint64_t nHeaderBytes = round_up(sizeof(SharedRingHeader));
+	const uint64_t nSlotBytes = round_up(
+		sizeof(SharedRingSlot) + static_cast<uint64_t>(nSlotSamples) * nChannels * nValueBytes);
+	m_nBytes = nHeaderBytes + nSlots * nSlotBytes;
+
+#if defined(_WIN32)
+	HANDLE hMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+		static_cast<DWORD>(m_nBytes >> 32), static_cast<DWORD>(m_nBytes), m_sName.c_str());
+	if (!hMapping || GetLastError() == ERROR_ALREADY_EXISTS)
+	{
+		// another writer, or readers still holding a previous ring of this name
+		if (hMapping) CloseHandle(hMapping);
+		throw std::runtime_error("Could not create shared memory " + m_sName + ": " +
+								 (hMapping ? "it exists already" : last_error()));
+	}
+	m_pMapping = MapViewOfFile(hMapping, FILE_MAP_ALL_ACCESS, 0, 0, m_nBytes);
+	if (!m_pMapping)
+	{
+		const std::string sError = last_error();
+		CloseHandle(hMapping);
+		throw std::runtime_error("Could not map shared memory " + m_sName + ": " + sError);
+	}
+	m_hHandle = reinterpret_cast<intptr_t>(hMapping);
+#else
+	int fd = shm_open(m_sName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd < 0 && errno == EEXIST)
+	{
+		// replace a ring left behind by a writer that has gone away (its readers keep their
+		// mapping until they close), but never the ring of another running writer
+		if (!stale_segment(m_sName))
+			throw std::runtime_error("Could not create shared memory " + m_sName +
+									 ": it exists already and its writer is still running");
+		shm_unlink(m_sName.c_str());
+		fd = shm_open(m_sName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+	}
+	if (fd < 0)
+		throw std::runtime_error(
+			"Could not create shared memory " + m_sName + ": " + last_error());
+	// held until the writer closes fd or its process ends, see stale_segment(); without it the
+	// next writer would take this ring for a stale one. Blocks only while another writer's
+	// stale_segment() holds its shared lock for a moment.
+	int nLocked;
+	while ((nLocked = flock(fd, LOCK_EX)) != 0 && errno == EINTR) {}
+	if (nLocked != 0 || ftruncate(fd, static_cast<off_t>(m_nBytes)) != 0 ||
+		(m_pMapping = mmap(nullptr, m_nBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) ==
+			MAP_FAILED)
+	{
+		const std::string sError = last_error();
+		m_pMapping = nullptr;
+		shm_unlink(m_sName.c_str());
+		close(fd);
+		throw std::runtime_error("Could not " + std::string(nLocked ? "lock" : "map") +
+								 " shared memory " + m_sName + ": " + sError);
+	}
+	m_hHandle = fd;
+#endif
+
+	// the segment starts out zeroed, i.e. with every slot at sequence 0 and no magic yet
+	char* pBase = static_cast<char*>(m_pMapping);
+	for (int k = 0; k < nSlots; k++) new (pBase + nHeaderBytes + k * nSlotBytes) SharedRingSlot();
+	m_pHeader = new (pBase) SharedRingHeader();
+	m_pHeader->nVersion = SharedRingHeader::version;
+	m_pHeader->nFormat = static_cast<uint32_t>(nFormat);
+	m_pHeader->nChannels = static_cast<uint32_t>(nChannels);
+	m_pHeader->dRate = dRate;
+	m_pHeader->nSlots = static_cast<uint32_t>(nSlots);
+	m_pHeader->nSlotSamples = static_cast<uint32_t>(nSlotSamples);
+	m_pHeader->nHeaderBytes = nHeaderBytes;
+	m_pHeader->nSlotBytes = nSlotBytes;
+	m_pHeader->nWritten.store(0, std::memory_order_relaxed);
+	m_pHeader->nClosed.store(0, std::memory_order_relaxed);
+	std::strncpy(m_pHeader->szStreamName, sStreamName.c_str(),
+		sizeof(m_pHeader->szStreamName) - 1);
+	m_pHeader->nMagic.store(SharedRingHeader::magic, std::memory_order_release);
+}
+
+SharedMemoryWriter::~SharedMemoryWriter()
+{
+	m_pHeader->nClosed.store(1, std::memory_order_release);
+#if defined(_WIN32)
+	UnmapViewOfFile(m_pMapping);
+	CloseHandle(reinterpret_cast<HANDLE>(m_hHandle));
+#else
+	munmap(m_pMapping, m_nBytes);
+	shm_unlink(m_sName.c_str());
+	close(static_cast<int>(m_hHandle));
+#endif
+}
+
+void SharedMemoryWriter::Write(const void* pData, int nSamples, double dTimestamp)
+{
+	const int nSlotSamples = static_cast<int>(m_pHeader->nSlotSamples);
+	const std::size_t nSampleBytes = static_cast<std::size_t>(m_pHeader->nChannels) *
+									 shared_ring_value_bytes(m_pHeader->nFormat);
+	const char* pSource = static_cast<const char*>(pData);
+	// longer chunks go into consecutive slots, each stamped with the time of its last sample
+	for (int nLeft = nSamples; nLeft > nSlotSamples; nLeft -= nSlotSamples)
+	{
+		WriteSlot(pSource, nSlotSamples, dTimestamp - (nLeft - nSlotSamples) / m_pHeader->dRate);
+		pSource += nSlotSamples * nSampleBytes;
+	}
+	WriteSlot(pSource, nSamples - (nSamples - 1) / nSlotSamples * nSlotSamples, dTimestamp);
+}
+
+void SharedMemoryWriter::WriteSlot(const void* pData, int nSamples, double dTimestamp)
+{
+	char* pSlot = static_cast<char*>(m_pMapping) + m_pHeader->nHeaderBytes +
+				  (m_nWritten % m_pHeader->nSlots) * m_pHeader->nSlotBytes;
+	SharedRingSlot* pHeader = reinterpret_cast<SharedRingSlot*>(pSlot);
+	pHeader->nSequence.store(2 * m_nWritten + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	pHeader->nFirstSample = m_nSamples;
+	pHeader->dTimestamp = dTimestamp;
+	pHeader->nSamples = static_cast<uint32_t>(nSamples);
+	std::memcpy(pSlot + sizeof(SharedRingSlot), pData,
+		static_cast<std::size_t>(nSamples) * m_pHeader->nChannels *
+			shared_ring_value_bytes(m_pHeader->nFormat));
+	pHeader->nSequence.store(2 * m_nWritten + 2, std::memory_order_release);
+	m_nWritten++;
+	m_nSamples += nSamples;
+	m_pHeader->nWritten.store(m_nWritten, std::memory_order_release);
+}
+
+SharedMemoryReader::SharedMemoryReader(const std::string& sName)
+	: m_pMapping(nullptr), m_nBytes(0), m_hHandle(0), m_pHeader(nullptr), m_nNext(0),
+	  m_nPeekSequence(0), m_nLost(0)
+{
+	const std::string sSegment = segment_name(sName);
+#if defined(_WIN32)
+	HANDLE hMapping = OpenFileMappingA(FILE_MAP_READ, FALSE, sSegment.c_str());
+	if (!hMapping)
+		throw std::runtime_error("No shared memory " + sSegment + ": " + last_error());
+	m_pMapping = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+	MEMORY_BASIC_INFORMATION info;
+	if (!m_pMapping || !VirtualQuery(m_pMapping, &info, sizeof(info)))
+	{
+		const std::string sError = last_error();
+		if (m_pMapping) UnmapViewOfFile(m_pMapping);
+		CloseHandle(hMapping);
+		throw std::runtime_error("Could not map shared memory " + sSegment + ": " + sError);
+	}
+	m_nBytes = info.RegionSize;
+	m_hHandle = reinterpret_cast<intptr_t>(hMapping);
+#else
+	const int fd = shm_open(sSegment.c_str(), O_RDONLY, 0);
+	if (fd < 0) throw std::runtime_error("No shared memory " + sSegment + ": " + last_error());
+	struct stat status;
+	if (fstat(fd, &status) != 0 ||
+		(m_pMapping = mmap(nullptr, static_cast<std::size_t>(status.st_size), PROT_READ,
+			 MAP_SHARED, fd, 0)) == MAP_FAILED)
+	{
+		const std::string sError = last_error();
+		close(fd);
+		throw std::runtime_error("Could not map shared memory " + sSegment + ": " + sError);
+	}
+	m_nBytes = static_cast<uint64_t>(status.st_size);
+	close(fd);
+#endif
+
+	m_pHeader = static_cast<const SharedRingHeader*>(m_pMapping);
+	const char* szError = nullptr;
+	if (m_nBytes < sizeof(SharedRingHeader) ||
+		m_pHeader->nMagic.load(std::memory_order_acquire) != SharedRingHeader::magic)
+		szError = " isn't a sample ring, or not ready yet";
+	else if (m_pHeader->nVersion != SharedRingHeader::version)
+		szError = " has an unsupported version";
+	else if (m_pHeader->nHeaderBytes + m_pHeader->nSlots * m_pHeader->nSlotBytes > m_nBytes)
+		szError = " is truncated";
+	if (szError)
+	{
+		Unmap();
+		throw std::runtime_error("Shared memory " + sSegment + szError + '.');
+	}
+	m_nNext = m_pHeader->nWritten.load(std::memory_order_acquire);
+}
+
+SharedMemoryReader::~SharedMemoryReader() { Unmap(); }
+
+void SharedMemoryReader::Unmap()
+{
+#if defined(_WIN32)
+	UnmapViewOfFile(m_pMapping);
+	CloseHandle(reinterpret_cast<HANDLE>(m_hHandle));
+#else
+	munmap(m_pMapping, m_nBytes);
+#endif
+}
+
+const SharedRingSlot* SharedMemoryReader::Slot(uint64_t nChunk) const
+{
+	return reinterpret_cast<const SharedRingSlot*>(static_cast<const char*>(m_pMapping) +
+												   m_pHeader->nHeaderBytes +
+												   (nChunk % m_pHeader->nSlots) *
+													   m_pHeader->nSlotBytes);
+}
+
+bool SharedMemoryReader::Peek(SharedChunk& chunk)
+{
+	for (;;)
+	{
+		const uint64_t nWritten = m_pHeader->nWritten.load(std::memory_order_acquire);
+		if (m_nNext >= nWritten) return false;
+		// fell a whole ring behind: continue with the oldest chunk that's still there
+		if (nWritten - m_nNext > m_pHeader->nSlots)
+		{
+			m_nLost += nWritten - m_pHeader->nSlots - m_nNext;
+			m_nNext = nWritten - m_pHeader->nSlots;
+		}
+		const SharedRingSlot* pSlot = Slot(m_nNext);
+		m_nPeekSequence = pSlot->nSequence.load(std::memory_order_acquire);
+		if (m_nPeekSequence != 2 * m_nNext + 2)
+		{
+			// overwritten since nWritten was read
+			m_nLost++;
+			m_nNext++;
+			continue;
+		}
+		chunk.pData = reinterpret_cast<const char*>(pSlot) + sizeof(SharedRingSlot);
+		chunk.nSamples = static_cast<int>(pSlot->nSamples);
+		chunk.nFirstSample = pSlot->nFirstSample;
+		chunk.dTimestamp = pSlot->dTimestamp;
+		return true;
+	}
+}
+
+bool SharedMemoryReader::Intact() const
+{
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return Slot(m_nNext)->nSequence.load(std::memory_order_relaxed) == m_nPeekSequence;
+}
+
+void SharedMemoryReader::Advance() { m_nNext++; }
+
+bool SharedMemoryReader::Read(void* pDst, SharedChunk& chunk)
+{
+	while (Peek(chunk))
+	{
+		std::memcpy(pDst, chunk.pData,
+			static_cast<std::size_t>(std::min(chunk.nSamples, SlotSamples())) * Channels() *
+				shared_ring_value_bytes(Format()));
+		const bool bIntact = Intact();
+		if (!bIntact) m_nLost++;
+		Advance();
+		if (bIntact)
+		{
+			chunk.pData = pDst;
+			return true;
+		}
+	}
+	return false;
+}
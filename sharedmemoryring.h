@@ -0,0 +1,134 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// A ring of multiplexed chunks with time stamps in a named shared memory segment, so that
+// consumers on the same machine (a decoder, a recorder) read the samples where the writer put
+// them instead of receiving them through LSL's sockets. There is one writer (the reader thread
+// of the app) and any number of readers, which only map the segment and never write to it, so
+// a slow or crashed reader can't hold up the writer or the other readers: a reader that falls
+// more than the ring behind loses the overwritten chunks and is told how many.
+//
+// Every slot is protected by a sequence lock: its sequence number is odd while the writer
+// fills it and even afterwards, and a reader's copy is valid only if the number was the same
+// even value before and after copying.
+//
+// Chunks longer than a slot are split across consecutive slots, so the ring can be sized for
+// the typical chunk and holds a fixed amount of time whatever the writer's chunk size.
+//
+// Layout (host byte order): a SharedRingHeader at offset 0, then nSlots slots of nSlotBytes
+// each starting at nHeaderBytes; every slot starts with a SharedRingSlot, followed by the
+// chunk at offset sizeof(SharedRingSlot) with nSlotSamples x nChannels values.
+
+struct SharedRingHeader
+{
+	static const uint32_t magic = 0x52534142; // "BASR"
+	static const uint32_t version = 1;
+
+	std::atomic<uint32_t> nMagic; // set last, when the ring is ready
+	uint32_t nVersion;
+	uint32_t nFormat; // LSL's channel_format_t: cf_float32 = 1, cf_int16 = 5
+	uint32_t nChannels;
+	double dRate; // nominal sampling rate
+	uint32_t nSlots, nSlotSamples;
+	uint64_t nHeaderBytes, nSlotBytes;
+	std::atomic<uint64_t> nWritten; // chunks published so far
+	std::atomic<uint32_t> nClosed;	// the writer has gone away
+	char szStreamName[64];			// the LSL stream with the same samples
+};
+
+struct SharedRingSlot
+{
+	std::atomic<uint64_t> nSequence; // 2 k + 1 while chunk k is written, 2 k + 2 when it's done
+	uint64_t nFirstSample;			 // running index of the first sample of the chunk
+	double dTimestamp;				 // of the last sample, in LSL's local clock
+	uint32_t nSamples;
+	uint32_t nReserved;
+	uint64_t nPadding[4];
+};
+
+// one chunk as seen by a reader
+struct SharedChunk
+{
+	const void* pData; // nSamples x Channels() multiplexed values
+	int nSamples;
+	uint64_t nFirstSample;
+	double dTimestamp; // of the last sample
+};
+
+// Creates the segment and removes it again in the destructor; throws std::runtime_error if it
+// can't be created, or if a segment of that name exists and its writer is still running (one
+// whose writer has gone away is replaced).
+class SharedMemoryWriter
+{
+private:
+	std::string m_sName;
+	void* m_pMapping;
+	uint64_t m_nBytes;
+	intptr_t m_hHandle; // file mapping handle on Windows, locked descriptor elsewhere
+	SharedRingHeader* m_pHeader;
+	uint64_t m_nWritten, m_nSamples;
+
+	void WriteSlot(const void* pData, int nSamples, double dTimestamp);
+
+public:
+	// sName: segment name, without the leading '/' or "Local\"; nSlotSamples: most samples per
+	// slot; nSlots: slots in the ring
+	SharedMemoryWriter(const std::string& sName, const std::string& sStreamName, int nFormat,
+		int nChannels, double dRate, int nSlotSamples, int nSlots);
+	~SharedMemoryWriter();
+	SharedMemoryWriter(const SharedMemoryWriter&) = delete;
+	SharedMemoryWriter& operator=(const SharedMemoryWriter&) = delete;
+
+	// publishes nSamples multiplexed samples as one chunk, or as consecutive chunks of at most
+	// nSlotSamples if there are more; never blocks or allocates
+	void Write(const void* pData, int nSamples, double dTimestamp);
+	uint64_t Bytes() const { return m_nBytes; }
+};
+
+// Maps an existing segment read-only; throws std::runtime_error if there is none with that
+// name or it isn't a ring of this version. Readers start at the next chunk written.
+class SharedMemoryReader
+{
+private:
+	void* m_pMapping;
+	uint64_t m_nBytes;
+	intptr_t m_hHandle;
+	const SharedRingHeader* m_pHeader;
+	uint64_t m_nNext;		   // chunk to read next
+	uint64_t m_nPeekSequence; // sequence number of the chunk last returned by Peek()
+	uint64_t m_nLost;
+
+	const SharedRingSlot* Slot(uint64_t nChunk) const;
+	void Unmap();
+
+public:
+	explicit SharedMemoryReader(const std::string& sName);
+	~SharedMemoryReader();
+	SharedMemoryReader(const SharedMemoryReader&) = delete;
+	SharedMemoryReader& operator=(const SharedMemoryReader&) = delete;
+
+	// zero copy: the next chunk where it is in the ring; false if there's none yet. The writer
+	// may overwrite it once it is a whole ring ahead, so check Intact() after using the data,
+	// then Advance().
+	bool Peek(SharedChunk& chunk);
+	bool Intact() const;
+	void Advance();
+	// copies the next intact chunk to pDst, which must hold SlotSamples() x Channels() values;
+	// chunk.pData then points to pDst. False if there's none yet.
+	bool Read(void* pDst, SharedChunk& chunk);
+
+	int Format() const { return static_cast<int>(m_pHeader->nFormat); }
+	int Channels() const { return static_cast<int>(m_pHeader->nChannels); }
+	double Rate() const { return m_pHeader->dRate; }
+	int SlotSamples() const { return static_cast<int>(m_pHeader->nSlotSamples); }
+	std::string StreamName() const { return m_pHeader->szStreamName; }
+	// chunks that were overwritten before this reader got to them
+	uint64_t Lost() const { return m_nLost; }
+	// the writer has stopped; a new writer creates a new segment, which needs a new reader
+	bool Closed() const { return m_pHeader->nClosed.load(std::memory_order_acquire) != 0; }
+};
+
+// bytes per value of an LSL channel format (cf_float32 or cf_int16), 0 for others
+int shared_ring_value_bytes(int nFormat);
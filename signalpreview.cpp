@@ -0,0 +1,62 @@
+#include "signalpreview.h"
+#include "previewenvelope.h"
+#include <QPainter>
+#include <QTimer>
+#include <algorithm>
+
+SignalPreview::SignalPreview(QWidget *parent) : QWidget(parent), timer(new QTimer(this)) {
+	setMinimumSize(256, 200);
+	connect(timer, &QTimer::timeout, [this]() { update(); });
+}
+
+void SignalPreview::setSource(
+	std::shared_ptr<PreviewEnvelope> source, const std::vector<std::string> &labels) {
+	this->source = source;
+	this->labels = labels;
+	if (source)
+		timer->start(33);
+	else
+		timer->stop();
+	update();
+}
+
+void SignalPreview::paintEvent(QPaintEvent *) {
+	QPainter painter(this);
+	painter.fillRect(rect(), Qt::white);
+	if (!source) return;
+	const PreviewEnvelope::Frame &frame = source->AcquireFrame();
+	const int channels = source->Channels(), columns = source->Columns();
+	const int64_t shown = std::min<int64_t>(frame.nColumns, columns);
+	if (!shown || !channels) return;
+
+	const double rowHeight = static_cast<double>(height()) / channels;
+	const double columnWidth = static_cast<double>(width()) / columns;
+	const int64_t first = frame.nColumns - shown;
+	painter.setPen(QColor(0, 0, 140));
+	for (int c = 0; c < channels; c++) {
+		// center and scale each row on what is currently visible
+		float lo = frame.pfMin[(first % columns) * channels + c], hi = lo;
+		double mean = 0;
+		for (int64_t col = first; col < frame.nColumns; col++) {
+			const int offset = static_cast<int>(col % columns) * channels + c;
+			lo = std::min(lo, frame.pfMin[offset]);
+			hi = std::max(hi, frame.pfMax[offset]);
+			mean += (frame.pfMin[offset] + frame.pfMax[offset]) / (2.0 * shown);
+		}
+		const double range = std::max(hi - mean, mean - lo);
+		const double scale = range > 0 ? 0.45 * rowHeight / range : 0;
+		const double center = (c + 0.5) * rowHeight;
+		for (int64_t col = first; col < frame.nColumns; col++) {
+			const int offset = static_cast<int>(col % columns) * channels + c;
+			const int x = static_cast<int>((col - first) * columnWidth);
+			painter.drawLine(x, static_cast<int>(center - (frame.pfMax[offset] - mean) * scale), x,
+				static_cast<int>(center - (frame.pfMin[offset] - mean) * scale));
+		}
+	}
+	if (rowHeight >= 10) {
+		painter.setPen(Qt::darkGray);
+		for (int c = 0; c < channels && c < static_cast<int>(labels.size()); c++)
+			painter.drawText(2, static_cast<int>((c + 0.5) * rowHeight) + 4,
+				QString::fromStdString(labels[c]));
+	}
+}
@@ -0,0 +1,30 @@
+#ifndef SIGNALPREVIEW_H
+#define SIGNALPREVIEW_H
+#include <QWidget>
+#include <memory>
+#include <string>
+#include <vector>
+
+class PreviewEnvelope;
+class QTimer;
+
+// Scrolling min/max preview of all channels, repainted at display rate from the frames
+// the reader thread publishes in a PreviewEnvelope. Each channel row is centered on its
+// mean and scaled to its own range within the visible window.
+class SignalPreview : public QWidget {
+	Q_OBJECT
+public:
+	explicit SignalPreview(QWidget *parent = nullptr);
+	// starts repainting from the given source; nullptr stops and clears the preview
+	void setSource(std::shared_ptr<PreviewEnvelope> source, const std::vector<std::string> &labels);
+
+protected:
+	void paintEvent(QPaintEvent *ev) override;
+
+private:
+	std::shared_ptr<PreviewEnvelope> source;
+	std::vector<std::string> labels;
+	QTimer *timer;
+};
+
+#endif // SIGNALPREVIEW_H
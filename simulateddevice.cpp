@@ -0,0 +1,226 @@
+#include "simulateddevice.h"
+#include "BrainAmpIoCtl.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+const HANDLE INVALID_HANDLE_VALUE = reinterpret_cast<HANDLE>(-1);
+
+namespace {
+const double pi = 3.14159265358979323846;
+const double sampling_rate = 5000.0;
+// the driver holds this much data before it reports an overflow
+const double buffer_seconds = 2.0;
+const int32_t error_invalid_handle = 6;
+int32_t last_error = 0;
+
+class SimulatedDevice {
+public:
+	SimulatedDevice() : partial_reads(std::getenv("BRAINAMP_PARTIAL_READS") != nullptr) {
+		if (const char *replay = std::getenv("BRAINAMP_REPLAY")) {
+			std::ifstream file(replay, std::ios::binary);
+			std::vector<char> bytes(
+				(std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+			replay_data.resize(bytes.size() / sizeof(int16_t));
+			if (!replay_data.empty())
+				std::memcpy(replay_data.data(), bytes.data(), replay_data.size() * sizeof(int16_t));
+		}
+	}
+
+	bool ioctl(unsigned long code, const void *in, unsigned long in_size, void *out,
+		unsigned long out_size, DWORD *bytes_returned) {
+		*bytes_returned = 0;
+		if (code == IOCTL_BA_SETUP && in_size >= sizeof(BA_SETUP)) {
+			std::memcpy(&setup, in, sizeof(BA_SETUP));
+			if (setup.nChannels < 1 || setup.nChannels > 256 || setup.nPoints < 1) return false;
+		} else if (code == IOCTL_BA_START) {
+			// 0 = impedance, 1 = data, 2 = calibration signal on all channels
+			mode = 1;
+			if (in)
+				std::memcpy(&mode, in, std::min<unsigned long>(in_size, sizeof(mode)));
+			running = true;
+			error_state = 0;
+			produced = 0;
+			discarded = 0;
+			offset_corrected = 0;
+			start = std::chrono::steady_clock::now();
+		} else if (code == IOCTL_BA_CALIBRATION_SETTINGS &&
+				   in_size >= sizeof(BA_CALIBRATION_SETTINGS))
+			std::memcpy(&calibration, in, sizeof(BA_CALIBRATION_SETTINGS));
+		else if (code == IOCTL_BA_STOP)
+			running = false;
+		else if (code == IOCTL_BA_DCOFFSET_CORRECTION)
+			offset_corrected = produced;
+		else if (code == IOCTL_BA_DIGITALINPUT_PULL_UP && in_size >= sizeof(USHORT))
+			std::memcpy(&pull_up, in, sizeof(USHORT));
+		else if (code == IOCTL_BA_ERROR_STATE && out_size >= sizeof(long)) {
+			*static_cast<long *>(out) = error_state;
+			*bytes_returned = sizeof(long);
+		} else if (code == IOCTL_BA_BUFFERFILLING_STATE && out_size >= sizeof(long)) {
+			int64_t backlog = available() - produced;
+			long state = backlog > buffer_seconds * sampling_rate
+							 ? -1
+							 : static_cast<long>(100 * backlog / (buffer_seconds * sampling_rate));
+			*static_cast<long *>(out) = state;
+			*bytes_returned = sizeof(long);
+		} else if (code == IOCTL_BA_BUFFERMISSING_MS && out_size >= sizeof(long)) {
+			// the data discarded since the last query, in whole ms
+			const auto missing_ms = static_cast<long>(discarded * 1000 / sampling_rate);
+			discarded -= static_cast<int64_t>(missing_ms * sampling_rate / 1000);
+			*static_cast<long *>(out) = missing_ms;
+			*bytes_returned = sizeof(long);
+		} else if (code == IOCTL_BA_GET_SERIALNUMBER && out_size >= sizeof(ULONG)) {
+			*static_cast<ULONG *>(out) = 0x5151;
+			*bytes_returned = sizeof(ULONG);
+		} else if (code == IOCTL_BA_DRIVERVERSION && out_size >= sizeof(ULONG)) {
+			*static_cast<ULONG *>(out) = 1010041;
+			*bytes_returned = sizeof(ULONG);
+		}
+		return true;
+	}
+
+	bool read(int16_t *buffer, DWORD bytes, DWORD *bytes_read) {
+		*bytes_read = 0;
+		if (!running) return true;
+		const int words_per_sample = setup.nChannels + 1;
+		int64_t samples = bytes / (sizeof(int16_t) * words_per_sample);
+		int64_t backlog = available() - produced;
+		if (backlog > buffer_seconds * sampling_rate) {
+			// the reader didn't keep up, the driver discards the oldest data
+			discarded += backlog - static_cast<int64_t>(buffer_seconds * sampling_rate);
+			produced += backlog - static_cast<int64_t>(buffer_seconds * sampling_rate);
+			backlog = static_cast<int64_t>(buffer_seconds * sampling_rate);
+		}
+		if (backlog < samples) {
+			// all or nothing, unless partial reads are simulated like a driver may return them
+			if (!partial_reads || backlog == 0) return true;
+			samples = backlog;
+		}
+		for (int64_t s = 0; s < samples; s++, buffer += words_per_sample) generate(buffer);
+		*bytes_read = static_cast<DWORD>(samples * words_per_sample * sizeof(int16_t));
+		return true;
+	}
+
+private:
+	int64_t available() const {
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		return static_cast<int64_t>(elapsed.count() * sampling_rate);
+	}
+
+	// one multiplexed sample: a few µV of 10 Hz alpha with a per-channel phase, 50 Hz line
+	// noise and white noise, plus a 10 ms trigger pulse once per second; DC-coupled channels
+	// drift by 20 to 100 µV/s until the next DC offset correction
+	void generate(int16_t *sample) {
+		const double t = produced / sampling_rate;
+		const double alpha = std::sin(2 * pi * 10 * t);
+		const double line = std::sin(2 * pi * 50 * t);
+		const int words_per_sample = setup.nChannels + 1;
+		if (!replay_data.empty()) {
+			const size_t replay_samples = replay_data.size() / words_per_sample;
+			if (replay_samples) {
+				const int16_t *src = &replay_data[(produced % replay_samples) * words_per_sample];
+				std::memcpy(sample, src, words_per_sample * sizeof(int16_t));
+				produced++;
+				return;
+			}
+		}
+		if (mode == 2) {
+			generate_calibration(sample, t);
+			return;
+		}
+		for (int c = 0; c < setup.nChannels; c++) {
+			noise = noise * 1103515245u + 12345u;
+			const double white = static_cast<int>((noise >> 16) & 0x7fff) / 16384.0 - 1.0;
+			const int physical = static_cast<UCHAR>(setup.nChannelList[c] + 8);
+			const double drift = setup.nDCCoupling[c]
+									 ? (physical % 2 ? 20 : -20) * (1 + physical % 5) *
+										   (produced - offset_corrected) / sampling_rate
+									 : 0;
+			const double uv = 20 * alpha * (1 + physical % 4) / 4 + 5 * line + 2 * white + drift;
+			sample[c] = static_cast<int16_t>(
+				std::max(-32768.0, std::min(32767.0, uv * resolution_factor(c))));
+		}
+		const int64_t second = produced / static_cast<int64_t>(sampling_rate);
+		const int64_t in_second = produced % static_cast<int64_t>(sampling_rate);
+		const uint16_t code =
+			in_second < sampling_rate / 100 ? static_cast<uint16_t>(1 + second % 15) : 0;
+		sample[setup.nChannels] = static_cast<int16_t>(code ^ pull_up_mask());
+		produced++;
+	}
+
+	// the calibration generator: the same waveform on every channel, seen through channel
+	// gains that differ by up to +-1 % (and by 5 % on amplifier channel 7)
+	void generate_calibration(int16_t *sample, double t) {
+		const double cycles = std::fmod(t * calibration.nFrequency / 1000.0, 1.0);
+		double wave = 0;
+		switch (calibration.nWaveForm) {
+		case 0: wave = 2 * cycles - 1; break;
+		case 1: wave = 1 - 4 * std::fabs(cycles - 0.5); break;
+		case 2: wave = cycles < 0.5 ? 1 : -1; break;
+		default: wave = std::sin(2 * pi * cycles); break;
+		}
+		for (int c = 0; c < setup.nChannels; c++) {
+			const int physical = static_cast<UCHAR>(setup.nChannelList[c] + 8);
+			const double gain = 1 + 0.002 * (physical * 7 % 11 - 5) + (physical == 14 ? 0.05 : 0);
+			sample[c] = static_cast<int16_t>(100 * gain * wave * resolution_factor(c));
+		}
+		sample[setup.nChannels] = static_cast<int16_t>(pull_up_mask());
+		produced++;
+	}
+
+	// counts per microvolt for the resolution configured for channel c
+	double resolution_factor(int c) const {
+		const double unit_scales[] = {0.1, 0.5, 10., 152.6};
+		return 1.0 / unit_scales[setup.nResolution[c] & 3];
+	}
+
+	// unconnected inputs with a pull-up read as 1
+	uint16_t pull_up_mask() const {
+		return (pull_up & 0xff ? 0xff : 0) | (pull_up & 0xff00 ? 0xff00 : 0);
+	}
+
+	BA_SETUP setup{};
+	BA_CALIBRATION_SETTINGS calibration{2, 5000};
+	USHORT pull_up{0};
+	long mode{1};
+	long error_state{0};
+	bool running{false};
+	int64_t produced{0};
+	int64_t discarded{0}; // samples dropped on overflows and not yet reported
+	int64_t offset_corrected{0}; // sample of the last DC offset correction
+	uint32_t noise{1};
+	std::vector<int16_t> replay_data;
+	bool partial_reads; // return what's there instead of waiting for the whole request
+	std::chrono::steady_clock::time_point start;
+};
+} // namespace
+
+HANDLE CreateFileA(const char *name, int, int, void *, int, int, void *) {
+	if (std::string(name).find("BrainAmpUSB") == std::string::npos) {
+		last_error = error_invalid_handle;
+		return INVALID_HANDLE_VALUE;
+	}
+	return new SimulatedDevice();
+}
+
+bool DeviceIoControl(HANDLE device, unsigned long code, void *in, unsigned long in_size, void *out,
+	unsigned long out_size, DWORD *bytes_returned, void *) {
+	DWORD dummy;
+	return static_cast<SimulatedDevice *>(device)->ioctl(
+		code, in, in_size, out, out_size, bytes_returned ? bytes_returned : &dummy);
+}
+
+bool ReadFile(HANDLE device, void *buffer, DWORD bytes, DWORD *bytes_read, void *) {
+	return static_cast<SimulatedDevice *>(device)->read(
+		static_cast<int16_t *>(buffer), bytes, bytes_read);
+}
+
+void CloseHandle(HANDLE device) { delete static_cast<SimulatedDevice *>(device); }
+
+int32_t GetLastError() { return last_error; }
@@ -0,0 +1,41 @@
+#pragma once
+// Software stand-in for the BrainAmp USB driver on platforms without it (Linux / OS X).
+// It implements the subset of the Win32 device API used by the app, so the complete
+// acquisition pipeline can run (and be measured) without an amplifier. The generated
+// data is paced by the system clock at 5 kHz like the real amplifier; instead of
+// synthetic signals, a raw recording (multiplexed int16, channels + 1 trigger word per
+// sample) can be replayed by pointing the BRAINAMP_REPLAY environment variable at it.
+#include <cstdint>
+
+using HANDLE = void *;
+using DWORD = unsigned long;
+using ULONG = unsigned long;
+using USHORT = uint16_t;
+using CHAR = signed char;
+using UCHAR = unsigned char;
+
+enum SimulatedDeviceConstants {
+	FILE_DEVICE_UNKNOWN = 0x22,
+	METHOD_BUFFERED = 0,
+	METHOD_NEITHER = 3,
+	FILE_READ_DATA = 1,
+	FILE_WRITE_DATA = 2,
+	GENERIC_READ = 0,
+	GENERIC_WRITE = 0,
+	FILE_ATTRIBUTE_NORMAL = 0,
+	FILE_FLAG_WRITE_THROUGH = 0,
+	OPEN_EXISTING = 0
+};
+constexpr unsigned long CTL_CODE(int type, int function, int method, int access) {
+	return (static_cast<unsigned long>(type) << 16) | (static_cast<unsigned long>(access) << 14) |
+		   (static_cast<unsigned long>(function) << 2) | static_cast<unsigned long>(method);
+}
+extern const HANDLE INVALID_HANDLE_VALUE;
+
+HANDLE CreateFileA(const char *name, int access, int share, void *security, int disposition,
+	int flags, void *templ);
+bool DeviceIoControl(HANDLE device, unsigned long code, void *in, unsigned long in_size, void *out,
+	unsigned long out_size, DWORD *bytes_returned, void *overlapped);
+bool ReadFile(HANDLE device, void *buffer, DWORD bytes, DWORD *bytes_read, void *overlapped);
+void CloseHandle(HANDLE device);
+int32_t GetLastError();
@@ -0,0 +1,176 @@
+#include "threadscheduling.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <avrt.h>
+#elif defined(__linux__)
+#include <cerrno>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+WakeupJitter measure_wakeup_jitter(int wakeups, double period) {
+	using clock = std::chrono::steady_clock;
+	std::vector<double> late(wakeups);
+	const auto interval = std::chrono::duration_cast<clock::duration>(
+		std::chrono::duration<double>(period));
+	auto next = clock::now() + interval;
+	for (auto &l : late) {
+		std::this_thread::sleep_until(next);
+		l = std::chrono::duration<double, std::micro>(clock::now() - next).count();
+		next += interval;
+	}
+	std::sort(late.begin(), late.end());
+	WakeupJitter jitter{0, late[late.size() * 99 / 100], late.back()};
+	for (double l : late) jitter.mean += l / late.size();
+	return jitter;
+}
+
+// touch every page so the first access in the hot path doesn't fault
+static void prefault(void *data, std::size_t bytes) {
+	volatile char *p = static_cast<volatile char *>(data);
+	for (std::size_t i = 0; i < bytes; i += 4096) p[i] = p[i];
+}
+
+#if defined(__linux__)
+ThreadScheduling::ThreadScheduling(bool realtime, int cpu) {
+	sched_param param{};
+	pthread_getschedparam(pthread_self(), &old_policy_, &param);
+	old_priority_ = param.sched_priority;
+	if (realtime) {
+		param.sched_priority = sched_get_priority_max(SCHED_FIFO) - 10;
+		int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if (err == 0)
+			realtime_ = true;
+		else
+			message_ += "SCHED_FIFO: " + std::string(std::strerror(err)) +
+						" (check 'ulimit -r' / CAP_SYS_NICE); ";
+	}
+	if (cpu < -1 || cpu >= CPU_SETSIZE)
+		message_ += "CPU " + std::to_string(cpu) + ": out of range; ";
+	else if (cpu >= 0) {
+		cpu_set_t *old = new cpu_set_t;
+		pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), old);
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		if (err == 0) {
+			cpu_ = cpu;
+			old_affinity_ = old;
+		} else {
+			message_ += "CPU " + std::to_string(cpu) + ": " + std::strerror(err) + "; ";
+			delete old;
+		}
+	}
+	if (realtime) {
+		if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0) {
+			memory_locked_ = true;
+			// prefault a generous stack reserve as well
+			char stack[256 * 1024];
+			prefault(stack, sizeof(stack));
+		} else
+			message_ += "mlockall: " + std::string(std::strerror(errno)) +
+						" (check 'ulimit -l'); ";
+	}
+}
+
+void ThreadScheduling::lock(void *data, std::size_t bytes) {
+	prefault(data, bytes);
+	// mlockall already covers everything that is mapped
+	if (!realtime_ || memory_locked_ || !bytes) return;
+	if (mlock(data, bytes) == 0) locked_.emplace_back(data, bytes);
+}
+
+ThreadScheduling::~ThreadScheduling() {
+	for (auto &region : locked_) munlock(region.first, region.second);
+	if (memory_locked_) munlockall();
+	if (old_affinity_) {
+		pthread_setaffinity_np(
+			pthread_self(), sizeof(cpu_set_t), static_cast<cpu_set_t *>(old_affinity_));
+		delete static_cast<cpu_set_t *>(old_affinity_);
+	}
+	if (realtime_) {
+		sched_param param{};
+		param.sched_priority = old_priority_;
+		pthread_setschedparam(pthread_self(), old_policy_, &param);
+	}
+}
+
+#elif defined(_WIN32)
+ThreadScheduling::ThreadScheduling(bool realtime, int cpu) {
+	old_priority_ = GetThreadPriority(GetCurrentThread());
+	if (realtime) {
+		DWORD task_index = 0;
+		mmcss_handle_ = AvSetMmThreadCharacteristicsA("Pro Audio", &task_index);
+		if (mmcss_handle_ && AvSetMmThreadPriority(mmcss_handle_, AVRT_PRIORITY_CRITICAL))
+			realtime_ = true;
+		else if (SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL))
+			realtime_ = true;
+		else
+			message_ += "real-time priority: error " + std::to_string(GetLastError()) + "; ";
+	} else
+		// only the reader thread, the process priority class stays untouched
+		SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+	// one bit per core in the affinity mask of the thread's processor group
+	if (cpu < -1 || cpu >= static_cast<int>(sizeof(DWORD_PTR) * 8))
+		message_ += "CPU " + std::to_string(cpu) + ": out of range; ";
+	else if (cpu >= 0) {
+		DWORD_PTR old = SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu);
+		if (old) {
+			cpu_ = cpu;
+			old_affinity_ = reinterpret_cast<void *>(old);
+		} else
+			message_ += "CPU " + std::to_string(cpu) + ": error " +
+						std::to_string(GetLastError()) + "; ";
+	}
+	if (realtime) {
+		// VirtualLock is limited by the minimum working set size
+		SIZE_T min_ws, max_ws;
+		if (GetProcessWorkingSetSize(GetCurrentProcess(), &min_ws, &max_ws) &&
+			SetProcessWorkingSetSize(
+				GetCurrentProcess(), min_ws + 64 * 1024 * 1024, max_ws + 64 * 1024 * 1024)) {
+			memory_locked_ = true;
+			char stack[256 * 1024];
+			prefault(stack, sizeof(stack));
+		} else
+			message_ += "working set size: error " + std::to_string(GetLastError()) + "; ";
+	}
+}
+
+void ThreadScheduling::lock(void *data, std::size_t bytes) {
+	prefault(data, bytes);
+	if (!memory_locked_ || !bytes) return;
+	if (VirtualLock(data, bytes))
+		locked_.emplace_back(data, bytes);
+	else {
+		message_ += "VirtualLock: error " + std::to_string(GetLastError()) + "; ";
+		memory_locked_ = false;
+	}
+}
+
+ThreadScheduling::~ThreadScheduling() {
+	for (auto &region : locked_) VirtualUnlock(region.first, region.second);
+	if (old_affinity_)
+		SetThreadAffinityMask(GetCurrentThread(), reinterpret_cast<DWORD_PTR>(old_affinity_));
+	if (mmcss_handle_) AvRevertMmThreadCharacteristics(mmcss_handle_);
+	SetThreadPriority(GetCurrentThread(), old_priority_);
+}
+
+#else
+ThreadScheduling::ThreadScheduling(bool realtime, int cpu) {
+	if (realtime) message_ += "real-time scheduling is not supported on this platform; ";
+	if (cpu != -1) message_ += "CPU pinning is not supported on this platform; ";
+}
+
+void ThreadScheduling::lock(void *data, std::size_t bytes) { prefault(data, bytes); }
+
+ThreadScheduling::~ThreadScheduling() {}
+#endif
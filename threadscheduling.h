@@ -0,0 +1,44 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// how late a periodic sleep wakes up, in microseconds
+struct WakeupJitter {
+	double mean, p99, max;
+};
+WakeupJitter measure_wakeup_jitter(int wakeups = 200, double period = 0.001);
+
+// Scheduling settings for the calling thread only (the GUI thread is left alone):
+// real-time priority (SCHED_FIFO on Linux, MMCSS "Pro Audio" on Windows), an optional
+// fixed core and locked memory, so that neither other processes nor page faults can
+// delay the acquisition. Everything is reverted by the destructor, which therefore has to
+// run in the same thread as the constructor.
+class ThreadScheduling {
+public:
+	// cpu -1: don't pin the thread; cores the platform can't address are reported in message()
+	ThreadScheduling(bool realtime, int cpu);
+	~ThreadScheduling();
+	ThreadScheduling(const ThreadScheduling &) = delete;
+	ThreadScheduling &operator=(const ThreadScheduling &) = delete;
+
+	// prefaults a preallocated buffer and keeps it in physical memory
+	void lock(void *data, std::size_t bytes);
+
+	bool realtime() const { return realtime_; }
+	int cpu() const { return cpu_; }
+	bool memory_locked() const { return memory_locked_; }
+	// human readable list of the settings that could not be applied
+	const std::string &message() const { return message_; }
+
+private:
+	bool realtime_{false};
+	int cpu_{-1};
+	bool memory_locked_{false};
+	std::string message_;
+	std::vector<std::pair<void *, std::size_t>> locked_;
+	// platform specific state to restore
+	int old_policy_{0}, old_priority_{0};
+	void *old_affinity_{nullptr};
+	void *mmcss_handle_{nullptr};
+};
@@ -0,0 +1,134 @@
+// Exercises the control endpoint of a running app (started with --control <name>): status,
+// reconfigure, link, status while acquiring, reconfigure while linked, malformed requests and
+// unlink, checking every reply. With --start, it launches the app itself, which acquires from
+// the simulated amplifier on Linux and OS X, and closes it again at the end.
+//
+// usage: control_client [--start <BrainAmpSeries executable>] [name=BrainAmpSeries]
+#include <QCoreApplication>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLocalSocket>
+#include <QProcess>
+#include <QThread>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+static QLocalSocket *socket = nullptr;
+static int failures = 0;
+
+// sends one request line and waits for its reply
+static QJsonObject request(const QByteArray &line) {
+	socket->write(line + '\n');
+	socket->waitForBytesWritten(1000);
+	while (!socket->canReadLine())
+		if (!socket->waitForReadyRead(30000)) {
+			std::printf("no reply to %s\n", line.constData());
+			std::exit(2);
+		}
+	return QJsonDocument::fromJson(socket->readLine()).object();
+}
+
+static QJsonObject request(const QJsonObject &object) {
+	return request(QJsonDocument(object).toJson(QJsonDocument::Compact));
+}
+
+static void check(bool condition, const char *what, const QJsonObject &reply) {
+	std::printf("%s %s\n", condition ? "ok    " : "FAILED", what);
+	if (!condition) {
+		std::printf("       reply: %s\n", QJsonDocument(reply).toJson().constData());
+		failures++;
+	}
+}
+
+int main(int argc, char *argv[]) {
+	QCoreApplication app(argc, argv);
+	QLocalSocket connection;
+	socket = &connection;
+	QString name = "BrainAmpSeries";
+	QProcess process;
+	for (int k = 1; k < argc; k++) {
+		if (std::string(argv[k]) == "--start" && k + 1 < argc)
+			process.setProgram(argv[++k]);
+		else
+			name = argv[k];
+	}
+	if (!process.program().isEmpty()) {
+		process.setArguments({"--control", name});
+		process.setProcessChannelMode(QProcess::ForwardedChannels);
+		process.start();
+		if (!process.waitForStarted()) {
+			std::printf("could not start %s\n", process.program().toStdString().c_str());
+			return 2;
+		}
+	}
+	// the app opens the endpoint once its window is set up
+	for (int attempt = 0; attempt < 100; attempt++) {
+		socket->connectToServer(name);
+		if (socket->waitForConnected(100)) break;
+		QThread::msleep(100);
+	}
+	if (socket->state() != QLocalSocket::ConnectedState) {
+		std::printf("could not connect to %s: %s\n", name.toStdString().c_str(),
+			socket->errorString().toStdString().c_str());
+		return 2;
+	}
+
+	QJsonObject reply = request(QJsonObject{{"command", "status"}, {"id", 1}});
+	check(reply["ok"].toBool() && reply["id"].toInt() == 1, "status echoes the request id", reply);
+	if (reply["status"].toObject()["linked"].toBool()) request(QJsonObject{{"command", "unlink"}});
+
+	reply = request(QJsonObject{{"command", "reconfigure"},
+		{"settings", QJsonObject{{"samplingrate", 1000}, {"chunksize", 20},
+						 {"latencybudget", 0}, {"additionalrates", QJsonArray()}}}});
+	QJsonObject settings = reply["status"].toObject()["settings"].toObject();
+	check(reply["ok"].toBool() && settings["samplingrate"].toInt() == 1000 &&
+			  settings["chunksize"].toInt() == 20,
+		"reconfigure while unlinked", reply);
+
+	reply = request(QJsonObject{
+		{"command", "reconfigure"}, {"settings", QJsonObject{{"nosuchsetting", 1}}}});
+	check(!reply["ok"].toBool(), "unknown settings are rejected", reply);
+
+	reply = request(QJsonObject{{"command", "link"}});
+	check(reply["ok"].toBool() && reply["status"].toObject()["linked"].toBool(), "link", reply);
+
+	QThread::msleep(2000);
+	reply = request(QJsonObject{{"command", "status"}});
+	QJsonObject status = reply["status"].toObject();
+	QJsonObject counters = status["counters"].toObject();
+	check(status["acquiring"].toBool() && counters["blocks"].toDouble() > 0 &&
+			  counters["samples"].toDouble() >= 5000 && counters["block_samples"].toInt() == 100,
+		"blocks are acquired at 20 samples of 1000 Hz", reply);
+
+	reply = request(QJsonObject{{"command", "reconfigure"},
+		{"settings", QJsonObject{{"samplingrate", 500}, {"chunksize", 5}}}});
+	check(reply["ok"].toBool() && reply["status"].toObject()["linked"].toBool(),
+		"reconfigure while linked relinks", reply);
+
+	QThread::msleep(1000);
+	reply = request(QJsonObject{{"command", "status"}});
+	counters = reply["status"].toObject()["counters"].toObject();
+	check(reply["status"].toObject()["acquiring"].toBool() &&
+			  counters["block_samples"].toInt() == 50 && counters["blocks"].toDouble() > 0,
+		"blocks are acquired at 5 samples of 500 Hz", reply);
+
+	reply = request(QJsonObject{{"command", "bogus"}});
+	check(!reply["ok"].toBool(), "unknown commands are rejected", reply);
+	reply = request(QByteArray("{\"command\": "));
+	check(!reply["ok"].toBool(), "malformed JSON is rejected", reply);
+	reply = request(QByteArray("[1, 2]"));
+	check(!reply["ok"].toBool(), "requests must be objects", reply);
+
+	reply = request(QJsonObject{{"command", "unlink"}});
+	check(reply["ok"].toBool() && !reply["status"].toObject()["linked"].toBool(), "unlink", reply);
+
+	socket->disconnectFromServer();
+	if (!process.program().isEmpty()) {
+		process.terminate();
+		if (!process.waitForFinished(5000)) process.kill();
+	}
+	std::printf("%d checks failed\n", failures);
+	return failures ? 1 : 0;
+}
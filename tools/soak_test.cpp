@@ -0,0 +1,273 @@
+// Soak and overload test: runs the app's complete acquisition pipeline at its most demanding
+// configuration (256 channels at 5 kHz, one-sample chunks) for a long time, while busy threads
+// compete for the CPU and slow LSL consumers fall behind. The app is driven through its
+// control endpoint. Every interval, this records:
+// - the app's memory footprint
+// - percentiles of the time the reader spends on a block (the processing time only, not the
+//   latency of the samples, which latency_benchmark measures at an inlet)
+// - how far the reader lags behind the amplifier, and the data the driver reports it dropped
+//   because of that (and any overflows in the amplifier itself)
+// It fails if the reader stops, or if any of these drift beyond their limits between the
+// start and the end of the run.
+//
+// usage: soak_test [--start <app>] [--name BrainAmpSeries] [--stream BrainAmpSeries-1]
+//                  [--duration 3600] [--interval 10] [--contention <cores>] [--consumers 2]
+//                  [--consumer-delay 500] [--max-memory-growth 50] [--max-p99-growth 2]
+//                  [--max-lag 1000] [--max-missing 0]
+#include <QCoreApplication>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLocalSocket>
+#include <QProcess>
+#include <QThread>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <lsl_cpp.h>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const double hardware_rate = 5000.0;
+static const int histogram_buckets = 64;
+
+struct Interval {
+	double seconds; // since the start of the measurement
+	double rss_mb;	// resident memory of the app, < 0 if unknown
+	std::vector<double> blocks; // processing time histogram of this interval
+	double proc_p50_us, proc_p99_us, proc_max_us; // processing time per block
+	double lag_ms;		   // reader behind the amplifier
+	double missing_ms;	   // data the driver dropped so far
+	double device_overflows;
+	qint64 incomplete_reads;
+};
+
+static QLocalSocket *socket = nullptr;
+
+static QJsonObject request(const QJsonObject &object) {
+	socket->write(QJsonDocument(object).toJson(QJsonDocument::Compact) + '\n');
+	socket->waitForBytesWritten(1000);
+	while (!socket->canReadLine())
+		if (!socket->waitForReadyRead(30000)) {
+			std::printf("no reply from the app\n");
+			std::exit(2);
+		}
+	return QJsonDocument::fromJson(socket->readLine()).object();
+}
+
+// upper edge in us of histogram bucket b (see PipelineCounters::blockUsHistogram)
+static double bucket_edge(int b) { return std::pow(2.0, (b + 1) / 4.0) - 1; }
+
+static double percentile(const std::vector<double> &histogram, double p) {
+	double total = 0;
+	for (double count : histogram) total += count;
+	if (total == 0) return 0;
+	double sum = 0;
+	for (int b = 0; b < histogram_buckets; b++)
+		if ((sum += histogram[b]) >= p * total) return bucket_edge(b);
+	return bucket_edge(histogram_buckets - 1);
+}
+
+static std::vector<double> histogram_of(const QJsonObject &status) {
+	std::vector<double> histogram(histogram_buckets, 0);
+	const QJsonArray array = status["block_us_histogram"].toArray();
+	for (int b = 0; b < std::min(histogram_buckets, array.size()); b++)
+		histogram[b] = array[b].toDouble();
+	return histogram;
+}
+
+// resident set size in MB, Linux only
+static double resident_mb(qint64 pid) {
+	std::ifstream file("/proc/" + std::to_string(pid) + "/status");
+	std::string line;
+	while (pid && std::getline(file, line))
+		if (line.compare(0, 6, "VmRSS:") == 0) return std::atof(line.c_str() + 6) / 1024;
+	return -1;
+}
+
+int main(int argc, char *argv[]) {
+	QCoreApplication app(argc, argv);
+	std::map<std::string, std::string> options{{"name", "BrainAmpSeries"},
+		{"stream", "BrainAmpSeries-1"}, {"duration", "3600"}, {"interval", "10"},
+		{"contention", std::to_string(std::thread::hardware_concurrency())}, {"consumers", "2"},
+		{"consumer-delay", "500"}, {"max-memory-growth", "50"}, {"max-p99-growth", "2"},
+		{"max-lag", "1000"}, {"max-missing", "0"}, {"start", ""}};
+	for (int k = 1; k + 1 < argc; k += 2) {
+		const std::string key = std::string(argv[k]).substr(2);
+		if (std::string(argv[k]).compare(0, 2, "--") || !options.count(key)) {
+			std::printf("unknown option %s\n", argv[k]);
+			return 2;
+		}
+		options[key] = argv[k + 1];
+	}
+	auto number = [&](const char *key) { return std::atof(options[key].c_str()); };
+
+	QProcess process;
+	if (!options["start"].empty()) {
+		process.setProgram(QString::fromStdString(options["start"]));
+		process.setArguments({"--control", QString::fromStdString(options["name"])});
+		process.setProcessChannelMode(QProcess::ForwardedChannels);
+		process.start();
+		if (!process.waitForStarted()) {
+			std::printf("could not start %s\n", options["start"].c_str());
+			return 2;
+		}
+	}
+	QLocalSocket connection;
+	socket = &connection;
+	for (int attempt = 0; attempt < 100; attempt++) {
+		socket->connectToServer(QString::fromStdString(options["name"]));
+		if (socket->waitForConnected(100)) break;
+		QThread::msleep(100);
+	}
+	if (socket->state() != QLocalSocket::ConnectedState) {
+		std::printf("could not connect to the app: %s\n",
+			socket->errorString().toStdString().c_str());
+		return 2;
+	}
+
+	// the most demanding configuration
+	QJsonArray labels;
+	for (int c = 1; c <= 256; c++) labels.append(QString::number(c));
+	request(QJsonObject{{"command", "unlink"}});
+	QJsonObject reply = request(QJsonObject{{"command", "reconfigure"},
+		{"settings", QJsonObject{{"channelcount", 256}, {"samplingrate", 5000}, {"chunksize", 1},
+						 {"latencybudget", 0}, {"additionalrates", QJsonArray()},
+						 {"usepolybox", false}, {"sendrawstream", false},
+						 {"channels/montage", QJsonArray()}, {"channels/labels", labels}}}});
+	if (reply["ok"].toBool()) reply = request(QJsonObject{{"command", "link"}});
+	if (!reply["ok"].toBool()) {
+		std::printf("could not start the acquisition: %s\n",
+			reply["error"].toString().toStdString().c_str());
+		return 2;
+	}
+
+	// busy threads compete with the reader for the CPU
+	std::atomic<bool> stop{false};
+	std::vector<std::thread> threads;
+	for (int t = 0; t < static_cast<int>(number("contention")); t++)
+		threads.emplace_back([&stop]() {
+			volatile double x = 1;
+			while (!stop)
+				for (int i = 0; i < 10000; i++) x = std::sqrt(x + i);
+		});
+	// consumers that pull only every few hundred ms and keep a short buffer; they get copies
+	// of their options, the map isn't safe to read while this thread uses it
+	std::atomic<long long> consumed{0};
+	const std::string stream = options["stream"];
+	const auto consumer_delay =
+		std::chrono::milliseconds(static_cast<int>(number("consumer-delay")));
+	for (int t = 0; t < static_cast<int>(number("consumers")); t++)
+		threads.emplace_back([&stop, &consumed, stream, consumer_delay]() {
+			std::vector<lsl::stream_info> results = lsl::resolve_stream("name", stream, 1, 10.0);
+			if (results.empty()) return;
+			lsl::stream_inlet inlet(results[0], 1);
+			std::vector<float> data;
+			std::vector<double> stamps;
+			while (!stop) {
+				inlet.pull_chunk_multiplexed(data, &stamps, 0.0);
+				consumed += stamps.size();
+				std::this_thread::sleep_for(consumer_delay);
+			}
+		});
+
+	// the first interval is the warm-up; its end is the baseline for everything else
+	const double duration = number("duration"), interval = number("interval");
+	const auto start = std::chrono::steady_clock::now();
+	QThread::msleep(static_cast<unsigned long>(interval * 1000));
+	QJsonObject status = request(QJsonObject{{"command", "status"}})["status"].toObject();
+	auto elapsed = [&start]() {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	};
+	const double t0 = elapsed();
+	const double samples0 = status["counters"].toObject()["samples"].toDouble();
+	const double missing0 = status["counters"].toObject()["missing_ms"].toDouble();
+	const double overflows0 = status["counters"].toObject()["device_overflows"].toDouble();
+	std::vector<double> previous = histogram_of(status);
+	const double rss0 = resident_mb(process.processId());
+
+	std::vector<Interval> intervals;
+	std::vector<std::string> failures;
+	std::printf("processing time per block in us\n%8s %8s %8s %8s %8s %9s %10s %10s\n", "time s",
+		"RSS MB", "proc p50", "proc p99", "proc max", "lag ms", "missing ms", "incomplete");
+	while (elapsed() - t0 < duration) {
+		QThread::msleep(static_cast<unsigned long>(interval * 1000));
+		status = request(QJsonObject{{"command", "status"}})["status"].toObject();
+		const double now = elapsed() - t0;
+		if (!status["acquiring"].toBool()) {
+			failures.push_back("the reader stopped after " + std::to_string(now) +
+							   " s: " + status["error"].toString().toStdString());
+			break;
+		}
+		const QJsonObject counters = status["counters"].toObject();
+		Interval i;
+		i.seconds = now;
+		i.rss_mb = resident_mb(process.processId());
+		const std::vector<double> histogram = histogram_of(status);
+		i.blocks.resize(histogram_buckets);
+		for (int b = 0; b < histogram_buckets; b++) i.blocks[b] = histogram[b] - previous[b];
+		previous = histogram;
+		i.proc_p50_us = percentile(i.blocks, 0.5);
+		i.proc_p99_us = percentile(i.blocks, 0.99);
+		i.proc_max_us = percentile(i.blocks, 1.0);
+		const double lag = now * hardware_rate - (counters["samples"].toDouble() - samples0);
+		i.lag_ms = 1000 * lag / hardware_rate;
+		i.missing_ms = counters["missing_ms"].toDouble() - missing0;
+		i.device_overflows = counters["device_overflows"].toDouble() - overflows0;
+		i.incomplete_reads = static_cast<qint64>(counters["incomplete_reads"].toDouble());
+		intervals.push_back(i);
+		std::printf("%8.0f %8.1f %8.0f %8.0f %8.0f %9.1f %10.0f %10lld\n", i.seconds, i.rss_mb,
+			i.proc_p50_us, i.proc_p99_us, i.proc_max_us, i.lag_ms, i.missing_ms, i.incomplete_reads);
+		std::fflush(stdout);
+	}
+	stop = true;
+	for (auto &thread : threads) thread.join();
+	request(QJsonObject{{"command", "unlink"}});
+
+	if (!intervals.empty()) {
+		// processing time of the first and the last quarter of the run
+		const std::size_t quarter = std::max<std::size_t>(1, intervals.size() / 4);
+		std::vector<double> first(histogram_buckets, 0), last(histogram_buckets, 0);
+		for (std::size_t k = 0; k < quarter; k++)
+			for (int b = 0; b < histogram_buckets; b++) {
+				first[b] += intervals[k].blocks[b];
+				last[b] += intervals[intervals.size() - 1 - k].blocks[b];
+			}
+		const double p99_first = percentile(first, 0.99), p99_last = percentile(last, 0.99);
+		std::printf("\np99 processing time first quarter %.0f us, last quarter %.0f us; "
+					"%lld samples consumed\n",
+			p99_first, p99_last, static_cast<long long>(consumed));
+		if (p99_last > number("max-p99-growth") * p99_first)
+			failures.push_back("the p99 processing time grew from " + std::to_string(p99_first) +
+							   " to " + std::to_string(p99_last) + " us");
+		const Interval &end = intervals.back();
+		if (rss0 >= 0 && end.rss_mb - rss0 > number("max-memory-growth"))
+			failures.push_back("the memory footprint grew by " +
+							   std::to_string(end.rss_mb - rss0) + " MB");
+		double max_lag = 0;
+		for (const auto &i : intervals) max_lag = std::max(max_lag, i.lag_ms);
+		if (max_lag > number("max-lag"))
+			failures.push_back("the reader fell " + std::to_string(max_lag) + " ms behind");
+		if (end.missing_ms > number("max-missing"))
+			failures.push_back(
+				"the driver dropped " + std::to_string(end.missing_ms) + " ms of data");
+		if (end.device_overflows > 0)
+			failures.push_back("the amplifier overflowed " +
+							   std::to_string(end.device_overflows) + " times");
+	}
+
+	socket->disconnectFromServer();
+	if (!options["start"].empty()) {
+		process.terminate();
+		if (!process.waitForFinished(5000)) process.kill();
+	}
+	for (const auto &failure : failures) std::printf("FAILED: %s\n", failure.c_str());
+	if (failures.empty()) std::printf("passed\n");
+	return failures.empty() ? 0 : 1;
+}